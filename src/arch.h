@@ -122,4 +122,12 @@
 #define FFI_64       1
 #endif
 
+/* SIMD instruction sets usable without runtime dispatch */
+#if defined(__SSE2__) || FFI_TARGET == FFI_ARCH_X64 || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FFI_SIMD_SSE2 1
+#else
+#define FFI_SIMD_SSE2 0
+#endif
+
 #endif
\ No newline at end of file
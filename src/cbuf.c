@@ -0,0 +1,64 @@
+/*
+** Growable byte buffers
+** tea_cbuf.c
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tea_ffi.h"
+#include "cbuf.h"
+#include "cmem.h"
+
+CBuffer* cbuf_new(tea_State* T, size_t cap)
+{
+    CBuffer* b = tea_new_udata(T, sizeof(CBuffer), BUFFER_MT);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+
+    if(cap)
+        cbuf_reserve(T, b, cap);
+
+    return b;
+}
+
+/* Make room for n more bytes, growing the storage geometrically so
+** appends are amortized. Returns the write position */
+char* cbuf_reserve(tea_State* T, CBuffer* b, size_t n)
+{
+    size_t cap = b->cap ? b->cap : CBUF_MIN;
+    size_t size;
+    char* data;
+
+    if(n <= b->cap - b->len)
+        return b->data + b->len;
+
+    if(n > SIZE_MAX / 2 - b->len)
+        tea_error(T, "buffer too large");
+
+    while(cap < b->len + n)
+        cap *= 2;
+
+    data = realloc(b->data, cap);
+    if(!data)
+        tea_error(T, "no mem");
+
+    /* The accounting may collect, the buffer has to be consistent first */
+    size = cap - b->cap;
+    b->data = data;
+    b->cap = cap;
+    cmem_extern_add(T, size);
+
+    return b->data + b->len;
+}
+
+void cbuf_free(tea_State* T, CBuffer* b)
+{
+    cmem_extern_sub(T, b->cap);
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+/*
+** Growable byte buffers
+** tea_cbuf.h
+*/
+
+#ifndef _TEA_CBUF_H
+#define _TEA_CBUF_H
+
+#include <string.h>
+
+#include <tea.h>
+
+#define CBUF_MIN    64
+
+typedef struct CBuffer
+{
+    char* data;
+    size_t len;
+    size_t cap;
+} CBuffer;
+
+CBuffer* cbuf_new(tea_State* T, size_t cap);
+char* cbuf_reserve(tea_State* T, CBuffer* b, size_t n);
+void cbuf_free(tea_State* T, CBuffer* b);
+
+static inline void cbuf_put(tea_State* T, CBuffer* b, const void* p, size_t n)
+{
+    memcpy(cbuf_reserve(T, b, n), p, n);
+    b->len += n;
+}
+
+#endif
\ No newline at end of file
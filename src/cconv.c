@@ -3,6 +3,8 @@
 ** tea_cconv.c
 */
 
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <ffi.h>
@@ -10,6 +12,7 @@
 #include "tea_ffi.h"
 #include "cdata.h"
 #include "cconv.h"
+#include "cbuf.h"
 
 #define PUSH_INTEGER(T, type, ptr) \
     do { \
@@ -170,22 +173,167 @@ static void cconv_tea_list(tea_State* T, CType* ct, void* ptr, int idx, bool cas
     }
 }
 
+enum
+{
+    CINIT_NUM,      /* Numbers and bools go straight through the ffi_type */
+    CINIT_ANY
+};
+
+typedef struct CInitStep
+{
+    const char* name;
+    CType* ct;
+    size_t offset;
+    uint8_t kind;
+} CInitStep;
+
+typedef struct CInit
+{
+    int nstep;
+    CInitStep steps[0];
+} CInit;
+
+/* Members of anonymous records are initialized as part of the enclosing one */
+static int cinit_count(CRecord* rc)
+{
+    int i, n = 0;
+
+    for(i = 0; i < rc->nfield; i++)
+    {
+        CRecordField* field = rc->fields[i];
+
+        if(!field->name[0] && field->ct->type == CTYPE_RECORD)
+            n += cinit_count(field->ct->rc);
+        else if(field->name[0])
+            n++;
+    }
+
+    return n;
+}
+
+static CInitStep* cinit_fill(CInitStep* s, CRecord* rc, size_t base)
+{
+    int i;
+
+    for(i = 0; i < rc->nfield; i++)
+    {
+        CRecordField* field = rc->fields[i];
+
+        if(!field->name[0])
+        {
+            if(field->ct->type == CTYPE_RECORD)
+                s = cinit_fill(s, field->ct->rc, base + field->offset);
+            continue;
+        }
+
+        s->name = field->name;
+        s->ct = field->ct;
+        s->offset = base + field->offset;
+        s->kind = ctype_is_num(field->ct) ? CINIT_NUM : CINIT_ANY;
+        s++;
+    }
+
+    return s;
+}
+
+/* The plan of a record lists its members in declaration order with their
+** final offsets. It is built once and lives as long as the record */
+static CInit* cinit_plan(tea_State* T, CRecord* rc)
+{
+    CInit* init;
+    int n;
+
+    if(rc->init)
+        return rc->init;
+
+    n = cinit_count(rc);
+    init = malloc(sizeof(CInit) + sizeof(CInitStep) * n);
+    if(!init)
+        tea_error(T, "no mem");
+
+    init->nstep = n;
+    cinit_fill(init->steps, rc, 0);
+    rc->init = init;
+
+    return init;
+}
+
+/* Store the value on top of the stack */
+static void cinit_step(tea_State* T, CInitStep* s, char* ptr, bool cast)
+{
+    int type = tea_get_type(T, -1);
+
+    if(s->kind == CINIT_NUM && (type == TEA_TYPE_NUMBER || type == TEA_TYPE_BOOL))
+    {
+        cconv_tea_num(T, s->ct, ptr + s->offset, -1, cast);
+        return;
+    }
+
+    cconv_cdata_tea(T, s->ct, ptr + s->offset, -1, cast);
+}
+
 /* Convert Teascript map to CData */
 static void cconv_tea_map(tea_State* T, CType* ct, void* ptr, int idx, bool cast)
 {
-    int i = 0;
-    while(i < ct->rc->nfield)
+    CInit* init = cinit_plan(T, ct->rc);
+    int i;
+
+    for(i = 0; i < init->nstep; i++)
     {
-        CRecordField* field = ct->rc->fields[i++];
+        CInitStep* s = &init->steps[i];
 
-        if(tea_get_key(T, idx, field->name))
+        if(tea_get_key(T, idx, s->name))
         {
-            cconv_cdata_tea(T, field->ct, ((char*)(ptr)) + field->offset, -1, cast);
+            cinit_step(T, s, ptr, cast);
             tea_pop(T, 1);
         }
     }
 }
 
+/* Steps taken by the first declared member of a union, all of them when
+** it is an anonymous record */
+static int cinit_first(CRecord* rc)
+{
+    int i;
+
+    for(i = 0; i < rc->nfield; i++)
+    {
+        CRecordField* field = rc->fields[i];
+
+        if(field->name[0])
+            return 1;
+        if(field->ct->type == CTYPE_RECORD && cinit_count(field->ct->rc) > 0)
+            return cinit_count(field->ct->rc);
+    }
+
+    return 0;
+}
+
+/* Positional initializer for a record, only the first member of a union */
+static void cconv_tea_record_list(tea_State* T, CType* ct, void* ptr, int idx, bool cast)
+{
+    CInit* init = cinit_plan(T, ct->rc);
+    int i, n = init->nstep;
+
+    if(ct->rc->is_union)
+        n = cinit_first(ct->rc);
+
+    if(tea_len(T, idx) > n)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "too many initializers for '%s'", tea_get_string(T, -1));
+    }
+
+    for(i = 0; i < n; i++)
+    {
+        if(!tea_get_item(T, idx, i))
+            break;
+
+        cinit_step(T, &init->steps[i], ptr, cast);
+        tea_pop(T, 1);
+    }
+}
+
 /* Convert Teascript value to CData */
 void cconv_cdata_tea(tea_State* T, CType* ct, void* ptr, int idx, bool cast)
 {
@@ -240,6 +388,15 @@ void cconv_cdata_tea(tea_State* T, CType* ct, void* ptr, int idx, bool cast)
             if(cconv_udata_cdata(T, ct, ptr, idx, cast))
                 return;
         }
+        else if(tea_test_udata(T, idx, BUFFER_MT))
+        {
+            /* Buffers hold bytes, other pointers need an explicit cast */
+            if(cast ? ct->type == CTYPE_PTR : ctype_ptr_to_bytes(ct))
+            {
+                *(void**)ptr = ((CBuffer*)tea_to_userdata(T, idx))->data;
+                return;
+            }
+        }
         else if(ct->type == CTYPE_PTR)
         {
             void* ud = tea_to_userdata(T, idx);
@@ -264,6 +421,11 @@ void cconv_cdata_tea(tea_State* T, CType* ct, void* ptr, int idx, bool cast)
             cconv_tea_list(T, ct, ptr, idx, cast);
             return;
         }
+        if(ct->type == CTYPE_RECORD)
+        {
+            cconv_tea_record_list(T, ct, ptr, idx, cast);
+            return;
+        }
         break;
     case TEA_TYPE_MAP:
         if(ct->type == CTYPE_RECORD)
@@ -289,4 +451,120 @@ void cconv_cdata_tea(tea_State* T, CType* ct, void* ptr, int idx, bool cast)
         tea_push_fstring(T, "cannot convert '%s' to '%s'", tea_typeof(T, idx), tea_get_string(T, -1));
     }
     tea_arg_error(T, idx, tea_get_string(T, -1));
+}
+
+/* Number of leading bytes of ct that converting the value at idx is sure
+** to overwrite, the rest of the payload has to be zeroed by the caller */
+size_t cconv_init_size(tea_State* T, CType* ct, int idx)
+{
+    CType* et;
+    size_t n;
+
+    switch(ct->type)
+    {
+    case CTYPE_ARRAY:
+        et = ct->array->ct;
+        switch(tea_get_type(T, idx))
+        {
+        case TEA_TYPE_LIST:
+            if(!ctype_is_num(et) && et->type != CTYPE_PTR)
+                return 0;
+            n = tea_len(T, idx);
+            if(n > ct->array->size)
+                n = ct->array->size;
+            return n * ctype_sizeof(et);
+        case TEA_TYPE_STRING:
+            if(et->type != CTYPE_CHAR)
+                return 0;
+            n = tea_len(T, idx) + 1;
+            return n < ctype_sizeof(ct) ? n : ctype_sizeof(ct);
+        default:
+            return 0;
+        }
+    case CTYPE_RECORD:
+        if(tea_test_udata(T, idx, CDATA_MT)
+            && ctype_equal(((CData*)tea_to_userdata(T, idx))->ct, ct))
+            return ctype_sizeof(ct);
+        return 0;
+    default:
+        return ctype_sizeof(ct);
+    }
+}
+
+static void cconv_tea_fields(tea_State* T, CType* ct, char* ptr, int depth, int flags)
+{
+    int i;
+
+    for(i = 0; i < ct->rc->nfield; i++)
+    {
+        CRecordField* field = ct->rc->fields[i];
+
+        /* Members of anonymous records belong to the enclosing map */
+        if(!field->name[0] && field->ct->type == CTYPE_RECORD)
+        {
+            cconv_tea_fields(T, field->ct, ptr + field->offset, depth, flags);
+            continue;
+        }
+
+        cconv_tea_deep(T, field->ct, ptr + field->offset, depth, flags);
+        tea_set_key(T, -2, field->name);
+    }
+}
+
+/* Convert a C value to plain Teascript values: records become maps and
+** arrays lists, down to depth levels of nesting. Below that aggregates are
+** copied into new cdata. Nothing refers back to ptr */
+void cconv_tea_deep(tea_State* T, CType* ct, void* ptr, int depth, int flags)
+{
+    size_t i, size;
+    CData* cd;
+
+    switch(ct->type)
+    {
+    case CTYPE_RECORD:
+        if(depth <= 0)
+            break;
+        tea_new_map(T);
+        cconv_tea_fields(T, ct, ptr, depth - 1, flags);
+        return;
+    case CTYPE_ARRAY:
+        if((flags & CCONV_STRINGS) && ct->array->ct->type == CTYPE_CHAR)
+        {
+            const char* p = memchr(ptr, '\0', ct->array->size);
+            tea_push_lstring(T, ptr, p ? (size_t)(p - (char*)ptr) : ct->array->size);
+            return;
+        }
+
+        if(depth <= 0)
+            break;
+
+        size = ctype_sizeof(ct->array->ct);
+        tea_new_list(T, ct->array->size);
+        for(i = 0; i < ct->array->size; i++)
+        {
+            cconv_tea_deep(T, ct->array->ct, (char*)ptr + size * i, depth - 1, flags);
+            tea_add_item(T, -2);
+        }
+        return;
+    case CTYPE_PTR:
+        if(!(flags & CCONV_POINTERS))
+        {
+            tea_push_integer(T, (intptr_t)*(void**)ptr);
+            return;
+        }
+        cd = cdata_new(T, ct, NULL);
+        cdata_ptr_set(cd, *(void**)ptr);
+        return;
+    default:
+        cconv_tea_cdata(T, ct, ptr);
+        return;
+    }
+
+    cd = cdata_new_uninit(T, ct, 0);
+    memcpy(cdata_ptr(cd), ptr, ctype_sizeof(ct));
+}
+
+void cconv_tea_value(tea_State* T, CType* ct, void* ptr)
+{
+    cconv_tea_deep(T, ct, ptr, INT_MAX, CCONV_STRINGS | CCONV_POINTERS);
 }
\ No newline at end of file
@@ -10,7 +10,14 @@
 
 #include "ctype.h"
 
+/* Flags of cconv_tea_deep */
+#define CCONV_STRINGS   0x01    /* Char arrays become strings */
+#define CCONV_POINTERS  0x02    /* Pointers stay cdata instead of addresses */
+
 void cconv_tea_cdata(tea_State* T, CType* ct, void* ptr);
 void cconv_cdata_tea(tea_State* T, CType* ct, void* ptr, int idx, bool cast);
+size_t cconv_init_size(tea_State* T, CType* ct, int idx);
+void cconv_tea_value(tea_State* T, CType* ct, void* ptr);
+void cconv_tea_deep(tea_State* T, CType* ct, void* ptr, int depth, int flags);
 
 #endif
\ No newline at end of file
@@ -11,16 +11,53 @@
 
 CData* cdata_new(tea_State* T, CType* ct, void* ptr)
 {
-    CData* cd = tea_new_udatav(T, sizeof(CData) + (ptr ? 0 : ctype_sizeof(ct)), 1, CDATA_MT);
+    CData* cd;
+
+    if(!ptr)
+        return cdata_new_aligned(T, ct, 0);
+
+    cd = tea_new_udatav(T, sizeof(CData), CDATA_NUV, CDATA_MT);
     cd->ptr = ptr;
     cd->ct = ct;
+    cd->align = 0;
+    cd->ext = 0;
 
-    tea_new_map(T);
-    tea_set_fieldp(T, TEA_REGISTRY_INDEX, cd);
+    return cd;
+}
 
-    if(!ptr)
-        memset(cdata_ptr(cd), 0, ctype_sizeof(ct));
+/* Allocate a payload aligned to at least the type's alignment, leaving
+** it uninitialized. Over-aligned payloads are placed at an aligned offset
+** inside the userdata and reached through cd->ptr */
+CData* cdata_new_uninit(tea_State* T, CType* ct, size_t align)
+{
+    size_t size = ctype_sizeof(ct);
+    CData* cd;
+
+    if(align < ctype_ft(ct)->alignment)
+        align = ctype_ft(ct)->alignment;
+
+    if(align <= CDATA_ALIGN)
+    {
+        cd = tea_new_udatav(T, sizeof(CData) + size, CDATA_NUV, CDATA_MT);
+        cd->ptr = NULL;
+    }
+    else
+    {
+        cd = tea_new_udatav(T, sizeof(CData) + size + align - 1, CDATA_NUV, CDATA_MT);
+        cd->ptr = (void*)(((uintptr_t)(cd + 1) + align - 1) & ~(uintptr_t)(align - 1));
+    }
 
+    cd->ct = ct;
+    cd->align = align;
+    cd->ext = 0;
+
+    return cd;
+}
+
+CData* cdata_new_aligned(tea_State* T, CType* ct, size_t align)
+{
+    CData* cd = cdata_new_uninit(T, ct, align);
+    memset(cdata_ptr(cd), 0, ctype_sizeof(ct));
     return cd;
 }
 
@@ -42,4 +79,97 @@ void cdata_ptr_set(CData* cd, void* ptr)
         return;
 
     *(void**)cdata_ptr(cd) = ptr;
+}
+
+/* Byte-wise equality of two values of ct, skipping record padding */
+bool cdata_equal(CType* ct, const void* a, const void* b)
+{
+    const char* pa = a;
+    const char* pb = b;
+    size_t i;
+
+    if(!ctype_padded(ct))
+        return !memcmp(a, b, ctype_sizeof(ct));
+
+    if(ct->type == CTYPE_ARRAY)
+    {
+        size_t size = ctype_sizeof(ct->array->ct);
+        for(i = 0; i < ct->array->size; i++)
+        {
+            if(!cdata_equal(ct->array->ct, pa + size * i, pb + size * i))
+                return false;
+        }
+        return true;
+    }
+
+    for(i = 0; i < ct->rc->nfield; i++)
+    {
+        CRecordField* field = ct->rc->fields[i];
+        if(!cdata_equal(field->ct, pa + field->offset, pb + field->offset))
+            return false;
+    }
+    return true;
+}
+
+/* Copy the bytes of a value of ct without record padding, returns the
+** number of bytes written to dst */
+size_t cdata_pack(CType* ct, const void* src, void* dst)
+{
+    const char* p = src;
+    char* d = dst;
+    size_t i;
+
+    if(!ctype_padded(ct))
+    {
+        memcpy(dst, src, ctype_sizeof(ct));
+        return ctype_sizeof(ct);
+    }
+
+    if(ct->type == CTYPE_ARRAY)
+    {
+        size_t size = ctype_sizeof(ct->array->ct);
+        for(i = 0; i < ct->array->size; i++)
+            d += cdata_pack(ct->array->ct, p + size * i, d);
+        return d - (char*)dst;
+    }
+
+    for(i = 0; i < ct->rc->nfield; i++)
+    {
+        CRecordField* field = ct->rc->fields[i];
+        d += cdata_pack(field->ct, p + field->offset, d);
+    }
+    return d - (char*)dst;
+}
+
+/* Reverse the byte order of every number in a value of ct in place */
+void cdata_bswap(CType* ct, void* p)
+{
+    char* b = p;
+    size_t i, n;
+
+    switch(ct->type)
+    {
+    case CTYPE_RECORD:
+        if(ct->rc->is_union)
+            return;
+        for(i = 0; i < ct->rc->nfield; i++)
+            cdata_bswap(ct->rc->fields[i]->ct, b + ct->rc->fields[i]->offset);
+        return;
+    case CTYPE_ARRAY:
+        n = ctype_sizeof(ct->array->ct);
+        for(i = 0; i < ct->array->size; i++)
+            cdata_bswap(ct->array->ct, b + n * i);
+        return;
+    default:
+        if(!ctype_is_num(ct))
+            return;
+        n = ctype_sizeof(ct);
+        for(i = 0; i < n / 2; i++)
+        {
+            char c = b[i];
+            b[i] = b[n - 1 - i];
+            b[n - 1 - i] = c;
+        }
+        return;
+    }
 }
\ No newline at end of file
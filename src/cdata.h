@@ -10,9 +10,33 @@
 
 #include "ctype.h"
 
+/* Alignment the Tea allocator guarantees for userdata payloads */
+#define CDATA_UDATA_ALIGN   sizeof(void*)
+
+/* Alignment of a payload stored right after the CData header: the lowest
+** set bit of the header size, capped at the userdata alignment */
+#define CDATA_LOWBIT(x) ((x) & (~(x) + 1))
+#define CDATA_ALIGN \
+    (CDATA_LOWBIT(sizeof(CData)) < CDATA_UDATA_ALIGN ? \
+        CDATA_LOWBIT(sizeof(CData)) : CDATA_UDATA_ALIGN)
+
+/* User values of a cdata */
+#define CDATA_FINALIZER 0
+#define CDATA_OWNER     1
+#define CDATA_CACHE     2
+#define CDATA_NUV       3
+
+/* Direct-mapped cache slots for children reached by index */
+#define CDATA_CACHE_SLOTS   16
+
 CData* cdata_new(tea_State* T, CType* ct, void* ptr);
+CData* cdata_new_aligned(tea_State* T, CType* ct, size_t align);
+CData* cdata_new_uninit(tea_State* T, CType* ct, size_t align);
 void* cdata_ptr_ptr(CData* cd);
 void cdata_ptr_set(CData* cd, void* ptr);
+bool cdata_equal(CType* ct, const void* a, const void* b);
+size_t cdata_pack(CType* ct, const void* src, void* dst);
+void cdata_bswap(CType* ct, void* p);
 
 static inline int cdata_type(CData* cd)
 {
@@ -0,0 +1,382 @@
+/*
+** FFI memory mappings and external memory accounting
+** tea_cmem.c
+*/
+
+#include <string.h>
+
+#include <tea.h>
+
+#include "teax.h"
+#include "arch.h"
+
+#include "tea_ffi.h"
+#include "cmem.h"
+
+#if FFI_TARGET_POSIX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CMEM_HUGEPAGE   (2 * 1024 * 1024)
+
+static void cmem_error(tea_State* T, const char* what, const char* name)
+{
+    tea_error(T, "cannot %s " TEA_QS ": %s", what, name, strerror(errno));
+}
+
+/* Map length bytes of a file starting at offset, 0 maps up to the end */
+void* cmem_map_file(tea_State* T, CMapping* m, const char* path, int mode, uint64_t offset, size_t* length)
+{
+    size_t delta = offset % (size_t)sysconf(_SC_PAGESIZE);
+    int fd = open(path, mode == CMEM_WRITE ? O_RDWR : O_RDONLY);
+    struct stat st;
+    void* base;
+    int err;
+
+    if(fd < 0)
+        cmem_error(T, "open", path);
+
+    if(fstat(fd, &st) < 0)
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        cmem_error(T, "stat", path);
+    }
+
+    if(offset >= (uint64_t)st.st_size || *length > (uint64_t)st.st_size - offset)
+    {
+        close(fd);
+        tea_error(T, "cannot map " TEA_QS ": range beyond end of file", path);
+    }
+
+    if(*length == 0)
+        *length = st.st_size - offset;
+
+    base = mmap(NULL, *length + delta,
+                mode == CMEM_READ ? PROT_READ : PROT_READ | PROT_WRITE,
+                mode == CMEM_COPY ? MAP_PRIVATE : MAP_SHARED,
+                fd, offset - delta);
+    err = errno;
+    close(fd);
+
+    if(base == MAP_FAILED)
+    {
+        errno = err;
+        cmem_error(T, "map", path);
+    }
+
+    m->base = base;
+    m->size = *length + delta;
+    m->mode = mode;
+
+    return (char*)base + delta;
+}
+
+/* Anonymous memory comes zeroed from the kernel, pages are only touched on
+** first access unless populate asks for them up front */
+void* cmem_map_anon(tea_State* T, CMapping* m, size_t size, bool hugepages, bool populate)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* base = MAP_FAILED;
+
+#ifdef MAP_POPULATE
+    if(populate)
+        flags |= MAP_POPULATE;
+#else
+    (void)populate;
+#endif
+
+#ifdef MAP_HUGETLB
+    if(hugepages)
+    {
+        /* Explicit huge pages need a reserved pool, fall back silently */
+        size_t hsize = (size + CMEM_HUGEPAGE - 1) & ~(size_t)(CMEM_HUGEPAGE - 1);
+        base = mmap(NULL, hsize, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if(base != MAP_FAILED)
+            size = hsize;
+    }
+#endif
+
+    if(base == MAP_FAILED)
+    {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if(base == MAP_FAILED)
+            tea_error(T, "cannot allocate %llu bytes: %s", (unsigned long long)size, strerror(errno));
+
+#ifdef MADV_HUGEPAGE
+        if(hugepages)
+            madvise(base, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    m->base = base;
+    m->size = size;
+    m->mode = CMEM_COPY;
+
+    return base;
+}
+
+void cmem_unmap(CMapping* m)
+{
+    if(m->base)
+        munmap(m->base, m->size);
+    m->base = NULL;
+}
+
+void cmem_advise(tea_State* T, CMapping* m, int advice)
+{
+    static const int advices[] = {
+        MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED
+    };
+
+    if(m->base && madvise(m->base, m->size, advices[advice]) < 0)
+        tea_error(T, "madvise failed: %s", strerror(errno));
+}
+
+void cmem_sync(tea_State* T, CMapping* m, bool async)
+{
+    if(!m->base || m->mode != CMEM_WRITE)
+        return;
+
+    if(msync(m->base, m->size, async ? MS_ASYNC : MS_SYNC) < 0)
+        tea_error(T, "msync failed: %s", strerror(errno));
+}
+
+#elif FFI_TARGET_WINDOWS
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+static void cmem_error(tea_State* T, const char* what, const char* name)
+{
+    DWORD err = GetLastError();
+
+    char buf[128];
+    if(!FormatMessageA(FORMAT_MESSAGE_IGNORE_INSERTS | FORMAT_MESSAGE_FROM_SYSTEM, NULL, err, 0, buf, sizeof(buf), NULL))
+        buf[0] = '\0';
+    tea_error(T, "cannot %s " TEA_QS ": %s", what, name, buf);
+}
+
+/* Map length bytes of a file starting at offset, 0 maps up to the end */
+void* cmem_map_file(tea_State* T, CMapping* m, const char* path, int mode, uint64_t offset, size_t* length)
+{
+    static const DWORD protect[] = { PAGE_READONLY, PAGE_READWRITE, PAGE_WRITECOPY };
+    static const DWORD access[] = { FILE_MAP_READ, FILE_MAP_WRITE, FILE_MAP_COPY };
+    SYSTEM_INFO si;
+    LARGE_INTEGER size;
+    HANDLE f, h;
+    uint64_t start;
+    void* base;
+
+    GetSystemInfo(&si);
+    start = offset - offset % si.dwAllocationGranularity;
+
+    f = CreateFileA(path, GENERIC_READ | (mode == CMEM_WRITE ? GENERIC_WRITE : 0),
+                    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(f == INVALID_HANDLE_VALUE)
+        cmem_error(T, "open", path);
+
+    if(!GetFileSizeEx(f, &size))
+    {
+        CloseHandle(f);
+        cmem_error(T, "stat", path);
+    }
+
+    if(offset >= (uint64_t)size.QuadPart || *length > (uint64_t)size.QuadPart - offset)
+    {
+        CloseHandle(f);
+        tea_error(T, "cannot map " TEA_QS ": range beyond end of file", path);
+    }
+
+    if(*length == 0)
+        *length = size.QuadPart - offset;
+
+    h = CreateFileMappingA(f, NULL, protect[mode], 0, 0, NULL);
+    CloseHandle(f);
+    if(!h)
+        cmem_error(T, "map", path);
+
+    base = MapViewOfFile(h, access[mode], (DWORD)(start >> 32), (DWORD)start, *length + (offset - start));
+    if(!base)
+    {
+        CloseHandle(h);
+        cmem_error(T, "map", path);
+    }
+
+    m->base = base;
+    m->size = *length + (offset - start);
+    m->handle = h;
+    m->mode = mode;
+
+    return (char*)base + (offset - start);
+}
+
+void* cmem_map_anon(tea_State* T, CMapping* m, size_t size, bool hugepages, bool populate)
+{
+    void* base = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if(!base)
+        tea_error(T, "cannot allocate %llu bytes", (unsigned long long)size);
+    (void)hugepages; (void)populate;
+
+    m->base = base;
+    m->size = size;
+    m->handle = NULL;
+    m->mode = CMEM_COPY;
+
+    return base;
+}
+
+void cmem_unmap(CMapping* m)
+{
+    if(m->base)
+    {
+        if(m->handle)
+        {
+            UnmapViewOfFile(m->base);
+            CloseHandle(m->handle);
+        }
+        else
+        {
+            VirtualFree(m->base, 0, MEM_RELEASE);
+        }
+    }
+    m->base = NULL;
+}
+
+void cmem_advise(tea_State* T, CMapping* m, int advice)
+{
+    /* Access pattern hints have no portable equivalent */
+    (void)T; (void)m; (void)advice;
+}
+
+void cmem_sync(tea_State* T, CMapping* m, bool async)
+{
+    if(!m->base || m->mode != CMEM_WRITE)
+        return;
+
+    if(!FlushViewOfFile(m->base, m->size))
+        tea_error(T, "FlushViewOfFile failed");
+    (void)async;
+}
+
+#else
+
+void* cmem_map_file(tea_State* T, CMapping* m, const char* path, int mode, uint64_t offset, size_t* length)
+{
+    tea_error(T, "no support for memory mapped files for this OS");
+    (void)m; (void)path; (void)mode; (void)offset; (void)length;
+    return NULL;
+}
+
+void* cmem_map_anon(tea_State* T, CMapping* m, size_t size, bool hugepages, bool populate)
+{
+    tea_error(T, "no support for anonymous memory mappings for this OS");
+    (void)m; (void)size; (void)hugepages; (void)populate;
+    return NULL;
+}
+
+void cmem_unmap(CMapping* m)
+{
+    m->base = NULL;
+}
+
+void cmem_advise(tea_State* T, CMapping* m, int advice)
+{
+    (void)T; (void)m; (void)advice;
+}
+
+void cmem_sync(tea_State* T, CMapping* m, bool async)
+{
+    (void)T; (void)m; (void)async;
+}
+
+#endif
+
+void cmem_tostring(tea_State* T, CMapping* m)
+{
+    if(m->base)
+        tea_push_fstring(T, "mapping: %p", m->base);
+    else
+        tea_push_literal(T, "mapping: closed");
+}
+
+/* -- External memory accounting ------------------------------------------ */
+
+/* The collector only sees the size of the userdata, so memory owned by a
+** cdata elsewhere is counted here and forces a collection once it has
+** grown by the larger of the step and the total left after the last one.
+** Each state keeps its own counters */
+static CMemState* cmem_state(tea_State* T)
+{
+    CMemState* s;
+
+    tea_get_fieldp(T, TEA_REGISTRY_INDEX, &cmem_registry);
+    s = tea_test_udata(T, -1, CMEM_MT);
+    tea_pop(T, 1);
+
+    return s;
+}
+
+/* Released memory comes off the debt too, or the debt could outgrow the
+** total and the check in cmem_extern_add would never fire again */
+static void cmem_release(CMemState* s, size_t size)
+{
+    s->total -= size < s->total ? size : s->total;
+    s->debt -= size < s->debt ? size : s->debt;
+}
+
+static const tea_Methods cmem_methods[] = {
+    { NULL, NULL }
+};
+
+void cmem_init(tea_State* T)
+{
+    CMemState* s;
+
+    tea_create_class(T, "CMemState", cmem_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, CMEM_MT);
+
+    s = tea_new_udata(T, sizeof(CMemState), CMEM_MT);
+    s->total = 0;
+    s->debt = 0;
+    s->step = CMEM_EXTERN_STEP;
+
+    tea_set_fieldp(T, TEA_REGISTRY_INDEX, &cmem_registry);
+}
+
+void cmem_extern_add(tea_State* T, size_t size)
+{
+    CMemState* s = cmem_state(T);
+
+    s->total += size;
+    s->debt += size;
+
+    if(s->debt > s->step && s->debt > s->total - s->debt)
+    {
+        s->debt = 0;
+        tea_gc(T);
+    }
+}
+
+void cmem_extern_sub(tea_State* T, size_t size)
+{
+    CMemState* s = cmem_state(T);
+
+    if(s)
+        cmem_release(s, size);
+}
+
+size_t cmem_extern_total(tea_State* T)
+{
+    return cmem_state(T)->total;
+}
+
+void cmem_extern_step(tea_State* T, size_t step)
+{
+    cmem_state(T)->step = step;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+/*
+** FFI memory mappings and external memory accounting
+** tea_cmem.h
+*/
+
+#ifndef _TEA_CMEM_H
+#define _TEA_CMEM_H
+
+#include <stdint.h>
+
+#include <tea.h>
+
+enum
+{
+    CMEM_READ,
+    CMEM_WRITE,
+    CMEM_COPY,
+};
+
+enum
+{
+    CMEM_NORMAL,
+    CMEM_SEQUENTIAL,
+    CMEM_RANDOM,
+    CMEM_WILLNEED,
+    CMEM_DONTNEED,
+};
+
+typedef struct CMapping
+{
+    void* base;
+    size_t size;
+    void* handle;
+    uint8_t mode;
+} CMapping;
+
+void* cmem_map_file(tea_State* T, CMapping* m, const char* path, int mode, uint64_t offset, size_t* length);
+void* cmem_map_anon(tea_State* T, CMapping* m, size_t size, bool hugepages, bool populate);
+void cmem_unmap(CMapping* m);
+void cmem_advise(tea_State* T, CMapping* m, int advice);
+void cmem_sync(tea_State* T, CMapping* m, bool async);
+void cmem_tostring(tea_State* T, CMapping* m);
+
+/* Minimum external growth between collections */
+#define CMEM_EXTERN_STEP    (64 * 1024 * 1024)
+
+/* External memory accounting of one state, kept in the registry */
+typedef struct CMemState
+{
+    size_t total;
+    size_t debt;
+    size_t step;
+} CMemState;
+
+void cmem_init(tea_State* T);
+void cmem_extern_add(tea_State* T, size_t size);
+void cmem_extern_sub(tea_State* T, size_t size);
+size_t cmem_extern_total(tea_State* T);
+void cmem_extern_step(tea_State* T, size_t step);
+
+#endif
\ No newline at end of file
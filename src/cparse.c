@@ -4,6 +4,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "lex.h"
 
@@ -133,6 +134,51 @@ static void check_void_forbidden(tea_State* T, CType* ct, int tok)
 
 static int cparse_record(tea_State* T, CType* ct, bool is_union);
 
+/* Parse any __attribute__((aligned(N))) specifiers, keeping the largest alignment */
+static int cparse_attribute(tea_State* T, int tok, size_t* align)
+{
+    while(cparse_check_tok(T, tok) == TOK_NAME && !strcmp(yyget_text(), "__attribute__"))
+    {
+        size_t n = 16;
+
+        tok = yylex();
+        if(cparse_check_tok(T, tok) != '(' || cparse_check_tok(T, tok = yylex()) != '(')
+            cparse_expected_error(T, tok, "(");
+
+        tok = yylex();
+        if(cparse_check_tok(T, tok) != TOK_NAME ||
+            (strcmp(yyget_text(), "aligned") && strcmp(yyget_text(), "__aligned__")))
+            return tea_error(T, "%d:unsupported attribute '%s'", yyget_lineno(), yyget_text());
+
+        tok = yylex();
+        if(cparse_check_tok(T, tok) == '(')
+        {
+            tok = yylex();
+            if(cparse_check_tok(T, tok) != TOK_INTEGER)
+                cparse_expected_error(T, tok, "integer");
+
+            n = atoi(yyget_text());
+            if(n == 0 || n > 0x8000 || (n & (n - 1)))
+                return tea_error(T, "%d:requested alignment is not a power of 2", yyget_lineno());
+
+            tok = yylex();
+            if(cparse_check_tok(T, tok) != ')')
+                cparse_expected_error(T, tok, ")");
+            tok = yylex();
+        }
+
+        if(cparse_check_tok(T, tok) != ')' || cparse_check_tok(T, tok = yylex()) != ')')
+            cparse_expected_error(T, tok, ")");
+
+        if(n > *align)
+            *align = n;
+
+        tok = yylex();
+    }
+
+    return tok;
+}
+
 static int cparse_record_field(tea_State* T, CRecordField** fields)
 {
     int nfield = 0;
@@ -208,7 +254,8 @@ add:
 static int cparse_record(tea_State* T, CType* ct, bool is_union)
 {
     bool named = false;
-    int tok = yylex();
+    size_t align = 0;
+    int tok = cparse_attribute(T, yylex(), &align);
 
     ct->type = CTYPE_RECORD;
 
@@ -320,7 +367,18 @@ static int cparse_record(tea_State* T, CType* ct, bool is_union)
             }
         }
 
-        return yylex();
+        tok = cparse_attribute(T, yylex(), &align);
+
+        /* Over-aligned records are padded up to a multiple of their alignment */
+        if(align > ct->rc->ft.alignment)
+        {
+            ct->rc->ft.alignment = align;
+            ct->rc->ft.size = (ct->rc->ft.size + align - 1) & ~(align - 1);
+        }
+
+        crecord_padding(ct);
+
+        return tok;
     }
     else
     {
@@ -595,6 +653,29 @@ static void cparse_function(tea_State* T, int tok, CType* rtype)
     tea_pop(T, 2);
 }
 
+/* Parse a single type name, an unsized trailing array is left to the caller */
+static void cparse_type_name(tea_State* T, const char* str, size_t len, CType* match, bool* flexible)
+{
+    int array_size;
+    int tok;
+
+    yy_scan_bytes(str, len);
+
+    yyset_lineno(0);
+
+    tok = cparse_basetype(T, yylex(), match);
+    tok = cparse_pointer(T, tok, match);
+    tok = cparse_array(T, tok, flexible, &array_size);
+
+    if(tok)
+        tea_error(T, "%d:unexpected '%s'", yyget_lineno(), yyget_text());
+
+    if(array_size >= 0)
+        cparse_new_array(T, array_size, match);
+
+    yylex_destroy();
+}
+
 CType* cparse_single(tea_State* T, bool* va, bool keep)
 {
     CData* cd;
@@ -606,39 +687,22 @@ CType* cparse_single(tea_State* T, bool* va, bool keep)
         const char* str = tea_check_lstring(T, 0, &len);
         bool flexible = false;
         CType match;
-        int array_size;
-        int tok;
-
-        yy_scan_bytes(str, len);
-
-        yyset_lineno(0);
 
         if(va)
             flexible = *va;
 
-        tok = cparse_basetype(T, yylex(), &match);
-        tok = cparse_pointer(T, tok, &match);
-        tok = cparse_array(T, tok, &flexible, &array_size);
+        cparse_type_name(T, str, len, &match, &flexible);
 
-        if(tok)
-            tea_error(T, "%d:unexpected '%s'", yyget_lineno(), yyget_text());
-
-        if(flexible || array_size >= 0)
+        if(flexible)
         {
-            if(flexible)
-            {
-                array_size = tea_check_integer(T, 1);
-                tea_arg_check(T, array_size > 0, 1, "array size must great than 0");
-            }
-
+            int array_size = tea_check_integer(T, 1);
+            tea_arg_check(T, array_size > 0, 1, "array size must great than 0");
             cparse_new_array(T, array_size, &match);
         }
 
         if(va)
             *va = flexible;
 
-        yylex_destroy();
-
         return ctype_lookup(T, &match, keep);
     }
 
@@ -666,6 +730,31 @@ CType* cparse_single(tea_State* T, bool* va, bool keep)
     return NULL;
 }
 
+/* Parse the type at idx, for "T[?]" return T and let the caller size the array */
+CType* cparse_flexible(tea_State* T, int idx, bool* flexible)
+{
+    CType* ct;
+
+    *flexible = false;
+
+    if(tea_is_string(T, idx))
+    {
+        size_t len;
+        const char* str = tea_check_lstring(T, idx, &len);
+        CType match;
+
+        *flexible = true;
+        cparse_type_name(T, str, len, &match, flexible);
+        return ctype_lookup(T, &match, false);
+    }
+
+    ct = tea_test_udata(T, idx, CTYPE_MT);
+    if(!ct)
+        tea_type_error(T, idx, "C type");
+
+    return ct;
+}
+
 void cparse_decl(tea_State* T, const char* p, size_t len)
 {
     yy_scan_bytes(p, len);
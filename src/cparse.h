@@ -11,6 +11,7 @@
 #include "ctype.h"
 
 CType* cparse_single(tea_State* T, bool* va, bool keep);
+CType* cparse_flexible(tea_State* T, int idx, bool* flexible);
 void cparse_decl(tea_State* T, const char* p, size_t len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+/*
+** Struct-of-arrays containers
+** tea_csoa.c
+*/
+
+#include <string.h>
+
+#include "tea_ffi.h"
+#include "teax.h"
+#include "csoa.h"
+
+static size_t csoa_align(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+/* Columns start at CSOA_ALIGN or at the alignment of an over-aligned
+** member type */
+static size_t csoa_field_align(CRecordField* field)
+{
+    size_t align = ctype_ft(field->ct)->alignment;
+    return align > CSOA_ALIGN ? align : CSOA_ALIGN;
+}
+
+/* Lay out one contiguous column per record field */
+CSoa* csoa_new(tea_State* T, CType* ct, size_t n)
+{
+    CRecord* rc = ct->rc;
+    size_t size = 0, align = CSOA_ALIGN;
+    CSoa* s;
+    int i;
+
+    for(i = 0; i < rc->nfield; i++)
+    {
+        size_t fsize = ctype_sizeof(rc->fields[i]->ct);
+        size_t falign = csoa_field_align(rc->fields[i]);
+
+        if(falign > align)
+            align = falign;
+        size = csoa_align(size, falign);
+        if(fsize && n > ((size_t)-1 - size) / fsize)
+            tea_error(T, "no mem");
+        size += fsize * n;
+    }
+
+    s = tea_new_udatav(T, sizeof(CSoa) + sizeof(size_t) * rc->nfield + align - 1 + size,
+                CSOA_NUV, SOA_MT);
+    s->ct = ct;
+    s->n = n;
+    s->data = (char*)csoa_align((size_t)(uintptr_t)(s->columns + rc->nfield), align);
+
+    size = 0;
+    for(i = 0; i < rc->nfield; i++)
+    {
+        size = csoa_align(size, csoa_field_align(rc->fields[i]));
+        s->columns[i] = size;
+        size += ctype_sizeof(rc->fields[i]->ct) * n;
+    }
+
+    memset(s->data, 0, size);
+
+    return s;
+}
+
+/* Find the column holding a field, members of anonymous records
+** resolve to the column of the enclosing member plus an offset */
+CType* csoa_field(CSoa* s, const char* name, int* col, size_t* offset)
+{
+    CRecord* rc = s->ct->rc;
+    int i;
+
+    for(i = 0; i < rc->nfield; i++)
+    {
+        CRecordField* field = rc->fields[i];
+
+        *offset = 0;
+
+        if(field->name[0])
+        {
+            if(!strcmp(field->name, name))
+            {
+                *col = i;
+                return field->ct;
+            }
+        }
+        else
+        {
+            field = crecord_find_field(field->ct->rc->fields, field->ct->rc->nfield, name, offset);
+            if(field)
+            {
+                *col = i;
+                return field->ct;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void csoa_tostring(tea_State* T, CSoa* s)
+{
+    teaB_buffer b;
+    teaB_buffinit(T, &b);
+    teaB_addstring(&b, "soa<");
+    __ctype_tostring(T, s->ct, &b);
+    tea_push_fstring(T, ">[%d]: %p", (int)s->n, s->data);
+    teaB_addvalue(&b);
+    teaB_pushresult(&b);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+/*
+** Struct-of-arrays containers
+** tea_csoa.h
+*/
+
+#ifndef _TEA_CSOA_H
+#define _TEA_CSOA_H
+
+#include <tea.h>
+
+#include "ctype.h"
+
+#define CSOA_ALIGN  16
+
+/* User values of a SoA */
+#define CSOA_COLUMNS    0   /* Map of column cdata by member name */
+#define CSOA_NUV        1
+
+typedef struct CSoa
+{
+    struct CType* ct;
+    size_t n;
+    char* data;
+    size_t columns[0];
+} CSoa;
+
+typedef struct CSoaRow
+{
+    CSoa* soa;
+    size_t idx;
+} CSoaRow;
+
+CSoa* csoa_new(tea_State* T, CType* ct, size_t n);
+CType* csoa_field(CSoa* s, const char* name, int* col, size_t* offset);
+void csoa_tostring(tea_State* T, CSoa* s);
+
+static inline void* csoa_column(CSoa* s, int col)
+{
+    return s->data + s->columns[col];
+}
+
+static inline void* csoa_ptr(CSoa* s, int col, size_t idx, size_t offset)
+{
+    return (char*)csoa_column(s, col) + ctype_sizeof(s->ct->rc->fields[col]->ct) * idx + offset;
+}
+
+#endif
\ No newline at end of file
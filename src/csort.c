@@ -0,0 +1,320 @@
+/*
+** C array sorting and searching
+** tea_csort.c
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ffi.h>
+
+#include "tea_ffi.h"
+#include "csort.h"
+
+typedef struct SortItem
+{
+    union
+    {
+        uint64_t u;
+        double d;
+    } key;
+    size_t idx;
+} SortItem;
+
+#define SORT_INSERTION  16
+
+/* Map an integer key to an unsigned value of the same width and ordering */
+static uint64_t csort_key_u64(ffi_type* ft, const void* p)
+{
+    switch(ft->type)
+    {
+    case FFI_TYPE_SINT8:
+        return *(const uint8_t*)p ^ 0x80;
+    case FFI_TYPE_UINT8:
+        return *(const uint8_t*)p;
+    case FFI_TYPE_SINT16:
+        return *(const uint16_t*)p ^ 0x8000;
+    case FFI_TYPE_UINT16:
+        return *(const uint16_t*)p;
+    case FFI_TYPE_SINT32:
+        return *(const uint32_t*)p ^ 0x80000000u;
+    case FFI_TYPE_UINT32:
+        return *(const uint32_t*)p;
+    case FFI_TYPE_SINT64:
+        return (uint64_t)*(const int64_t*)p ^ ((uint64_t)1 << 63);
+    default:
+        return *(const uint64_t*)p;
+    }
+}
+
+static double csort_key_f64(ffi_type* ft, const void* p)
+{
+    if(ft->type == FFI_TYPE_FLOAT)
+        return *(const float*)p;
+    return *(const double*)p;
+}
+
+/* NaN sorts after every other value */
+static inline bool csort_less_f64(double a, double b)
+{
+    return a < b || (b != b && a == a);
+}
+
+/* LSD radix sort, 8 bits per pass, skipping passes where all digits match.
+** Returns whichever of the two buffers holds the result */
+static SortItem* csort_radix(SortItem* items, SortItem* tmp, size_t n, size_t width)
+{
+    size_t count[256];
+    size_t shift, i;
+
+    for(shift = 0; shift < width * 8; shift += 8)
+    {
+        size_t sum = 0;
+        SortItem* t;
+
+        memset(count, 0, sizeof(count));
+        for(i = 0; i < n; i++)
+            count[(items[i].key.u >> shift) & 0xff]++;
+
+        if(count[(items[0].key.u >> shift) & 0xff] == n)
+            continue;
+
+        for(i = 0; i < 256; i++)
+        {
+            size_t c = count[i];
+            count[i] = sum;
+            sum += c;
+        }
+
+        for(i = 0; i < n; i++)
+            tmp[count[(items[i].key.u >> shift) & 0xff]++] = items[i];
+
+        t = items;
+        items = tmp;
+        tmp = t;
+    }
+
+    return items;
+}
+
+static void csort_insertion(SortItem* items, size_t n)
+{
+    size_t i, j;
+    for(i = 1; i < n; i++)
+    {
+        SortItem x = items[i];
+        for(j = i; j > 0 && csort_less_f64(x.key.d, items[j - 1].key.d); j--)
+            items[j] = items[j - 1];
+        items[j] = x;
+    }
+}
+
+static void csort_sift(SortItem* items, size_t root, size_t n)
+{
+    while(true)
+    {
+        size_t child = root * 2 + 1;
+        SortItem t;
+
+        if(child >= n)
+            return;
+        if(child + 1 < n && csort_less_f64(items[child].key.d, items[child + 1].key.d))
+            child++;
+        if(!csort_less_f64(items[root].key.d, items[child].key.d))
+            return;
+
+        t = items[root];
+        items[root] = items[child];
+        items[child] = t;
+        root = child;
+    }
+}
+
+static void csort_heap(SortItem* items, size_t n)
+{
+    size_t i;
+
+    for(i = n / 2; i > 0; i--)
+        csort_sift(items, i - 1, n);
+
+    for(i = n - 1; i > 0; i--)
+    {
+        SortItem t = items[0];
+        items[0] = items[i];
+        items[i] = t;
+        csort_sift(items, 0, i);
+    }
+}
+
+/* Quicksort falling back to heapsort past the depth limit */
+static void csort_intro(SortItem* items, size_t n, int depth)
+{
+    while(n > SORT_INSERTION)
+    {
+        SortItem pivot, t;
+        size_t i, j, mid = n / 2;
+
+        if(depth-- == 0)
+        {
+            csort_heap(items, n);
+            return;
+        }
+
+        /* Median of three */
+        if(csort_less_f64(items[mid].key.d, items[0].key.d))
+        {
+            t = items[mid]; items[mid] = items[0]; items[0] = t;
+        }
+        if(csort_less_f64(items[n - 1].key.d, items[0].key.d))
+        {
+            t = items[n - 1]; items[n - 1] = items[0]; items[0] = t;
+        }
+        if(csort_less_f64(items[n - 1].key.d, items[mid].key.d))
+        {
+            t = items[n - 1]; items[n - 1] = items[mid]; items[mid] = t;
+        }
+        pivot = items[mid];
+
+        i = 0;
+        j = n - 1;
+        while(true)
+        {
+            while(csort_less_f64(items[i].key.d, pivot.key.d))
+                i++;
+            while(csort_less_f64(pivot.key.d, items[j].key.d))
+                j--;
+            if(i >= j)
+                break;
+            t = items[i]; items[i] = items[j]; items[j] = t;
+            i++;
+            j--;
+        }
+
+        /* Recurse into the smaller half */
+        if(j + 1 < n - j - 1)
+        {
+            csort_intro(items, j + 1, depth);
+            items += j + 1;
+            n -= j + 1;
+        }
+        else
+        {
+            csort_intro(items + j + 1, n - j - 1, depth);
+            n = j + 1;
+        }
+    }
+
+    csort_insertion(items, n);
+}
+
+void csort_sort(tea_State* T, void* base, size_t n, size_t size, CType* kt, size_t koff, bool desc)
+{
+    ffi_type* ft = ctype_ft(kt);
+    SortItem* items;
+    char* tmp;
+    size_t i;
+    int depth;
+
+    if(n < 2)
+        return;
+
+    items = malloc(sizeof(SortItem) * n * 2);
+    tmp = malloc(size * n);
+    if(!items || !tmp)
+    {
+        free(items);
+        free(tmp);
+        tea_error(T, "no mem");
+    }
+
+    if(ctype_is_int(kt))
+    {
+        uint64_t mask = ft->size < 8 ? ((uint64_t)1 << (ft->size * 8)) - 1 : ~(uint64_t)0;
+        SortItem* sorted = items;
+        uint64_t bits = 0;
+
+        for(i = 0; i < n; i++)
+        {
+            uint64_t k = csort_key_u64(ft, (char*)base + size * i + koff);
+            items[i].key.u = desc ? ~k & mask : k;
+            items[i].idx = i;
+            bits |= items[i].key.u ^ items[0].key.u;
+        }
+
+        /* Only the low bytes that differ somewhere need a pass */
+        if(bits)
+        {
+            size_t width = 0;
+            while(width < 8 && bits >> (width * 8))
+                width++;
+            sorted = csort_radix(items, items + n, n, width);
+        }
+
+        for(i = 0; i < n; i++)
+            memcpy(tmp + size * i, (char*)base + size * sorted[i].idx, size);
+    }
+    else
+    {
+        for(i = 0; i < n; i++)
+        {
+            double k = csort_key_f64(ft, (char*)base + size * i + koff);
+            items[i].key.d = desc ? -k : k;
+            items[i].idx = i;
+        }
+
+        for(depth = 0, i = n; i; i >>= 1)
+            depth += 2;
+
+        csort_intro(items, n, depth);
+
+        for(i = 0; i < n; i++)
+            memcpy(tmp + size * i, (char*)base + size * items[i].idx, size);
+    }
+
+    memcpy(base, tmp, size * n);
+
+    free(items);
+    free(tmp);
+}
+
+/* Lower bound binary search over an ascending array, -1 if not found */
+ptrdiff_t csort_bsearch(void* base, size_t n, size_t size, CType* kt, size_t koff, const void* key)
+{
+    ffi_type* ft = ctype_ft(kt);
+    size_t lo = 0, hi = n;
+
+    if(ctype_is_int(kt))
+    {
+        uint64_t k = csort_key_u64(ft, key);
+
+        while(lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if(csort_key_u64(ft, (char*)base + size * mid + koff) < k)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if(lo < n && csort_key_u64(ft, (char*)base + size * lo + koff) == k)
+            return lo;
+    }
+    else
+    {
+        double k = csort_key_f64(ft, key);
+
+        while(lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if(csort_less_f64(csort_key_f64(ft, (char*)base + size * mid + koff), k))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if(lo < n && csort_key_f64(ft, (char*)base + size * lo + koff) == k)
+            return lo;
+    }
+
+    return -1;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+/*
+** C array sorting and searching
+** tea_csort.h
+*/
+
+#ifndef _TEA_CSORT_H
+#define _TEA_CSORT_H
+
+#include <stddef.h>
+
+#include <tea.h>
+
+#include "ctype.h"
+
+void csort_sort(tea_State* T, void* base, size_t n, size_t size, CType* kt, size_t koff, bool desc);
+ptrdiff_t csort_bsearch(void* base, size_t n, size_t size, CType* kt, size_t koff, const void* key);
+
+#endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "teax.h"
 #include "tea_ffi.h"
@@ -189,6 +190,104 @@ const char* ctype_name(CType* ct)
     }
 }
 
+CRecordField* crecord_find_field(
+        CRecordField** fields, int nfield, const char* name, size_t* offset)
+{
+    int i;
+    for(i = 0; i < nfield; i++)
+    {
+        CRecordField* field = fields[i];
+
+        if(field->name[0])
+        {
+            if(!strcmp(field->name, name))
+            {
+                *offset += field->offset;
+                return field;
+            }
+        }
+        else
+        {
+            field = crecord_find_field(field->ct->rc->fields, field->ct->rc->nfield, name, offset);
+            if(field)
+            {
+                *offset += fields[i]->offset;
+                return field;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Resolve a dotted member path such as "pos.x" through nested records */
+CType* crecord_find_path(CType* ct, const char* path, size_t* offset)
+{
+    char name[128];
+
+    *offset = 0;
+
+    while(true)
+    {
+        const char* dot = strchr(path, '.');
+        size_t len = dot ? (size_t)(dot - path) : strlen(path);
+        CRecordField* field;
+
+        if(ct->type != CTYPE_RECORD || len == 0 || len >= sizeof(name))
+            return NULL;
+
+        memcpy(name, path, len);
+        name[len] = '\0';
+
+        field = crecord_find_field(ct->rc->fields, ct->rc->nfield, name, offset);
+        if(!field)
+            return NULL;
+
+        ct = field->ct;
+
+        if(!dot)
+            return ct;
+
+        path = dot + 1;
+    }
+}
+
+/* Flag structs with gaps between or after their fields. Union members
+** overlap, so unions are compared as a whole */
+void crecord_padding(CType* ct)
+{
+    CRecord* rc = ct->rc;
+    size_t covered = 0;
+    int i;
+
+    rc->padded = false;
+    if(rc->is_union)
+        return;
+
+    for(i = 0; i < rc->nfield; i++)
+    {
+        CType* fct = rc->fields[i]->ct;
+        covered += ctype_sizeof(fct);
+        if(ctype_padded(fct))
+            rc->padded = true;
+    }
+
+    if(covered != ctype_sizeof(ct))
+        rc->padded = true;
+}
+
+bool ctype_padded(CType* ct)
+{
+    switch(ct->type)
+    {
+    case CTYPE_RECORD:
+        return ct->rc->padded;
+    case CTYPE_ARRAY:
+        return ctype_padded(ct->array->ct);
+    default:
+        return false;
+    }
+}
+
 static const char* cstruct_lookup_name(tea_State* T, CRecord* st)
 {
     tea_get_fieldp(T, TEA_REGISTRY_INDEX, &crecord_registry);
@@ -80,6 +80,9 @@ typedef struct CRecord
     uint8_t nfield;
     uint8_t is_union;
     uint8_t anonymous;
+    uint8_t padded;
+    uint8_t has_meta;       /* Methods attached with ffi.metatype */
+    struct CInit* init;     /* Initializer plan, built on first use */
     struct CRecordField* fields[0];
 } CRecord;
 
@@ -95,9 +98,15 @@ typedef struct CData
 {
     struct CType* ct;
     void* ptr;
+    uint32_t align;
+    size_t ext;         /* Bytes held outside the Tea heap */
 } CData;
 
 CArray* carray_lookup(tea_State* T, size_t size, CType* ct);
+CRecordField* crecord_find_field(CRecordField** fields, int nfield, const char* name, size_t* offset);
+CType* crecord_find_path(CType* ct, const char* path, size_t* offset);
+void crecord_padding(CType* ct);
+bool ctype_padded(CType* ct);
 CType* ctype_lookup(tea_State* T, CType* match, bool keep);
 bool ctype_equal(const CType* ct1, const CType* ct2);
 const char* ctype_name(CType* ct);
@@ -130,6 +139,25 @@ static inline bool ctype_ptr_to(CType* ct, int type)
     return ct->type != CTYPE_PTR ? false : ct->ptr->type == type;
 }
 
+/* Pointer to void or to single bytes */
+static inline bool ctype_ptr_to_bytes(CType* ct)
+{
+    if(ct->type != CTYPE_PTR)
+        return false;
+
+    switch(ct->ptr->type)
+    {
+    case CTYPE_VOID:
+    case CTYPE_CHAR:
+    case CTYPE_UCHAR:
+    case CTYPE_INT8_T:
+    case CTYPE_UINT8_T:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static inline bool ctype_is_int(CType* ct)
 {
     return ct->type < CTYPE_FLOAT;
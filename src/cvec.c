@@ -0,0 +1,530 @@
+/*
+** C vector operations
+** tea_cvec.c
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <ffi.h>
+
+#include "arch.h"
+#include "tea_ffi.h"
+#include "cvec.h"
+
+#if FFI_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Generic kernels, unrolled with independent accumulators so the compiler
+** can keep them in vector registers */
+#define CVEC_ARITH(name, type, acc) \
+    static acc cvec_sum_##name(const type* p, size_t n) \
+    { \
+        acc s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+        size_t i = 0; \
+        for(; i + 4 <= n; i += 4) \
+        { \
+            s0 += p[i]; \
+            s1 += p[i + 1]; \
+            s2 += p[i + 2]; \
+            s3 += p[i + 3]; \
+        } \
+        for(; i < n; i++) \
+            s0 += p[i]; \
+        return (s0 + s1) + (s2 + s3); \
+    } \
+    static acc cvec_dot_##name(const type* a, const type* b, size_t n) \
+    { \
+        acc s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+        size_t i = 0; \
+        for(; i + 4 <= n; i += 4) \
+        { \
+            s0 += (acc)a[i] * b[i]; \
+            s1 += (acc)a[i + 1] * b[i + 1]; \
+            s2 += (acc)a[i + 2] * b[i + 2]; \
+            s3 += (acc)a[i + 3] * b[i + 3]; \
+        } \
+        for(; i < n; i++) \
+            s0 += (acc)a[i] * b[i]; \
+        return (s0 + s1) + (s2 + s3); \
+    }
+
+#define CVEC_CMP(name, type) \
+    static size_t cvec_extreme_##name(const type* p, size_t n, bool max) \
+    { \
+        type m0 = p[0], m1 = p[0], m2 = p[0], m3 = p[0]; \
+        size_t i = 0; \
+        if(max) \
+        { \
+            for(; i + 4 <= n; i += 4) \
+            { \
+                m0 = p[i] > m0 ? p[i] : m0; \
+                m1 = p[i + 1] > m1 ? p[i + 1] : m1; \
+                m2 = p[i + 2] > m2 ? p[i + 2] : m2; \
+                m3 = p[i + 3] > m3 ? p[i + 3] : m3; \
+            } \
+            for(; i < n; i++) \
+                m0 = p[i] > m0 ? p[i] : m0; \
+            m0 = m1 > m0 ? m1 : m0; \
+            m2 = m3 > m2 ? m3 : m2; \
+            m0 = m2 > m0 ? m2 : m0; \
+        } \
+        else \
+        { \
+            for(; i + 4 <= n; i += 4) \
+            { \
+                m0 = p[i] < m0 ? p[i] : m0; \
+                m1 = p[i + 1] < m1 ? p[i + 1] : m1; \
+                m2 = p[i + 2] < m2 ? p[i + 2] : m2; \
+                m3 = p[i + 3] < m3 ? p[i + 3] : m3; \
+            } \
+            for(; i < n; i++) \
+                m0 = p[i] < m0 ? p[i] : m0; \
+            m0 = m1 < m0 ? m1 : m0; \
+            m2 = m3 < m2 ? m3 : m2; \
+            m0 = m2 < m0 ? m2 : m0; \
+        } \
+        /* Second pass locates the first occurrence */ \
+        for(i = 0; i < n; i++) \
+            if(p[i] == m0) \
+                return i; \
+        return 0; \
+    } \
+    static size_t cvec_count_##name(const type* p, size_t n, type v) \
+    { \
+        size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0; \
+        size_t i = 0; \
+        for(; i + 4 <= n; i += 4) \
+        { \
+            c0 += p[i] == v; \
+            c1 += p[i + 1] == v; \
+            c2 += p[i + 2] == v; \
+            c3 += p[i + 3] == v; \
+        } \
+        for(; i < n; i++) \
+            c0 += p[i] == v; \
+        return (c0 + c1) + (c2 + c3); \
+    }
+
+CVEC_ARITH(i8, int8_t, int64_t)
+CVEC_ARITH(u8, uint8_t, uint64_t)
+CVEC_ARITH(i16, int16_t, int64_t)
+CVEC_ARITH(u16, uint16_t, uint64_t)
+CVEC_ARITH(i32, int32_t, int64_t)
+CVEC_ARITH(u32, uint32_t, uint64_t)
+CVEC_ARITH(i64, int64_t, int64_t)
+CVEC_ARITH(u64, uint64_t, uint64_t)
+#if !FFI_SIMD_SSE2
+CVEC_ARITH(f32, float, double)
+CVEC_ARITH(f64, double, double)
+#endif
+
+CVEC_CMP(i8, int8_t)
+CVEC_CMP(u8, uint8_t)
+CVEC_CMP(i16, int16_t)
+CVEC_CMP(u16, uint16_t)
+CVEC_CMP(i32, int32_t)
+CVEC_CMP(u32, uint32_t)
+CVEC_CMP(i64, int64_t)
+CVEC_CMP(u64, uint64_t)
+CVEC_CMP(f32, float)
+CVEC_CMP(f64, double)
+
+#undef CVEC_ARITH
+#undef CVEC_CMP
+
+#if FFI_SIMD_SSE2
+
+/* Floating point sums are not reassociated by the compiler, so these are
+** written by hand. A scalar head brings the pointer to a 16-byte boundary
+** (when it is element aligned at all) and a scalar tail finishes the rest */
+
+#define CVEC_HEAD(type, p, n, i, s, expr) \
+    if(((uintptr_t)(p) & (sizeof(type) - 1)) == 0) \
+    { \
+        for(; i < n && ((uintptr_t)((p) + i) & 15); i++) \
+            s += expr; \
+    }
+
+static double cvec_hsum_pd(__m128d a, __m128d b)
+{
+    double t[2];
+    _mm_storeu_pd(t, _mm_add_pd(a, b));
+    return t[0] + t[1];
+}
+
+static double cvec_sum_f64(const double* p, size_t n)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    double s = 0;
+    size_t i = 0;
+
+    CVEC_HEAD(double, p, n, i, s, p[i]);
+
+    for(; i + 4 <= n; i += 4)
+    {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(p + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(p + i + 2));
+    }
+
+    s += cvec_hsum_pd(s0, s1);
+
+    for(; i < n; i++)
+        s += p[i];
+
+    return s;
+}
+
+static double cvec_sum_f32(const float* p, size_t n)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    double s = 0;
+    size_t i = 0;
+
+    CVEC_HEAD(float, p, n, i, s, p[i]);
+
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(p + i);
+        s0 = _mm_add_pd(s0, _mm_cvtps_pd(v));
+        s1 = _mm_add_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+
+    s += cvec_hsum_pd(s0, s1);
+
+    for(; i < n; i++)
+        s += p[i];
+
+    return s;
+}
+
+static double cvec_dot_f64(const double* a, const double* b, size_t n)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    double s = 0;
+    size_t i = 0;
+
+    CVEC_HEAD(double, a, n, i, s, a[i] * b[i]);
+
+    for(; i + 4 <= n; i += 4)
+    {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+
+    s += cvec_hsum_pd(s0, s1);
+
+    for(; i < n; i++)
+        s += a[i] * b[i];
+
+    return s;
+}
+
+static double cvec_dot_f32(const float* a, const float* b, size_t n)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    double s = 0;
+    size_t i = 0;
+
+    CVEC_HEAD(float, a, n, i, s, (double)a[i] * b[i]);
+
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(va, va)),
+                                       _mm_cvtps_pd(_mm_movehl_ps(vb, vb))));
+    }
+
+    s += cvec_hsum_pd(s0, s1);
+
+    for(; i < n; i++)
+        s += (double)a[i] * b[i];
+
+    return s;
+}
+
+#undef CVEC_HEAD
+
+#endif
+
+/* Select the kernel matching the element's ffi_type */
+#define CVEC_DISPATCH(ct, CASE) \
+    switch(ctype_ft(ct)->type) \
+    { \
+    case FFI_TYPE_SINT8: CASE(i8, int8_t); \
+    case FFI_TYPE_UINT8: CASE(u8, uint8_t); \
+    case FFI_TYPE_SINT16: CASE(i16, int16_t); \
+    case FFI_TYPE_UINT16: CASE(u16, uint16_t); \
+    case FFI_TYPE_SINT32: CASE(i32, int32_t); \
+    case FFI_TYPE_UINT32: CASE(u32, uint32_t); \
+    case FFI_TYPE_SINT64: CASE(i64, int64_t); \
+    case FFI_TYPE_UINT64: CASE(u64, uint64_t); \
+    case FFI_TYPE_FLOAT: CASE(f32, float); \
+    case FFI_TYPE_DOUBLE: CASE(f64, double); \
+    default: break; \
+    }
+
+void cvec_sum(tea_State* T, CType* ct, const void* p, size_t n)
+{
+#define CASE(name, type) \
+    if(ctype_is_int(ct)) \
+        tea_push_integer(T, cvec_sum_##name((const type*)p, n)); \
+    else \
+        tea_push_number(T, cvec_sum_##name((const type*)p, n)); \
+    return
+
+    CVEC_DISPATCH(ct, CASE)
+#undef CASE
+    tea_push_integer(T, 0);
+}
+
+void cvec_dot(tea_State* T, CType* ct, const void* a, const void* b, size_t n)
+{
+#define CASE(name, type) \
+    if(ctype_is_int(ct)) \
+        tea_push_integer(T, cvec_dot_##name((const type*)a, (const type*)b, n)); \
+    else \
+        tea_push_number(T, cvec_dot_##name((const type*)a, (const type*)b, n)); \
+    return
+
+    CVEC_DISPATCH(ct, CASE)
+#undef CASE
+    tea_push_integer(T, 0);
+}
+
+/* Index of the first minimum (or maximum) element, n must be > 0 */
+size_t cvec_extreme(CType* ct, const void* p, size_t n, bool max)
+{
+#define CASE(name, type) \
+    return cvec_extreme_##name((const type*)p, n, max)
+
+    CVEC_DISPATCH(ct, CASE)
+#undef CASE
+    return 0;
+}
+
+/* Number of elements equal to the element stored at v */
+size_t cvec_count_eq(CType* ct, const void* p, size_t n, const void* v)
+{
+#define CASE(name, type) \
+    return cvec_count_##name((const type*)p, n, *(const type*)v)
+
+    CVEC_DISPATCH(ct, CASE)
+#undef CASE
+    return 0;
+}
+
+/* Copy n elements of the given size between strided buffers. A zero
+** source stride broadcasts a single element */
+void cvec_copy_strided(void* dst, size_t dstride, const void* src, size_t sstride, size_t n, size_t size)
+{
+    char* d = dst;
+    const char* s = src;
+    size_t i = 0;
+
+    if(dstride == size && sstride == size)
+    {
+        memcpy(dst, src, size * n);
+        return;
+    }
+
+    /* Fixed size copies compile down to single loads and stores */
+#define CASE(w) \
+    case w: \
+        for(; i + 4 <= n; i += 4) \
+        { \
+            memcpy(d + dstride * i, s + sstride * i, w); \
+            memcpy(d + dstride * (i + 1), s + sstride * (i + 1), w); \
+            memcpy(d + dstride * (i + 2), s + sstride * (i + 2), w); \
+            memcpy(d + dstride * (i + 3), s + sstride * (i + 3), w); \
+        } \
+        for(; i < n; i++) \
+            memcpy(d + dstride * i, s + sstride * i, w); \
+        return
+
+    switch(size)
+    {
+    CASE(1);
+    CASE(2);
+    CASE(4);
+    CASE(8);
+    default:
+        break;
+    }
+#undef CASE
+
+    for(; i < n; i++)
+        memcpy(d + dstride * i, s + sstride * i, size);
+}
+
+/* -- Byte search and fill ------------------------------------------------ */
+
+/* Offset of the first occurrence of needle, SIZE_MAX if there is none */
+size_t cvec_find(const void* p, size_t n, const void* needle, size_t m)
+{
+    const uint8_t* s = p;
+    const uint8_t* end = s + n;
+    const uint8_t* k = needle;
+
+    if(m == 0)
+        return 0;
+
+    while(m <= (size_t)(end - s))
+    {
+        s = memchr(s, k[0], (end - s) - m + 1);
+        if(!s)
+            break;
+        if(!memcmp(s + 1, k + 1, m - 1))
+            return s - (const uint8_t*)p;
+        s++;
+    }
+
+    return SIZE_MAX;
+}
+
+/* Length of a NUL-terminated string, at most max. The scan is left to
+** libc's strlen and memchr, which are already vectorized, so the bound
+** is all that is added here */
+size_t cvec_strnlen(const char* p, size_t max)
+{
+    const char* e;
+
+    if(max == SIZE_MAX)
+        return strlen(p);
+
+    e = memchr(p, '\0', max);
+    return e ? (size_t)(e - p) : max;
+}
+
+/* Repeat pat over n bytes, doubling the filled prefix with each copy */
+void cvec_fill_pattern(void* dst, size_t n, const void* pat, size_t m)
+{
+    uint8_t* d = dst;
+    size_t filled;
+
+    if(m == 1)
+    {
+        memset(dst, *(const uint8_t*)pat, n);
+        return;
+    }
+
+    filled = m < n ? m : n;
+    memcpy(d, pat, filled);
+
+    while(filled < n)
+    {
+        size_t c = filled < n - filled ? filled : n - filled;
+        memcpy(d + filled, d, c);
+        filled += c;
+    }
+}
+
+/* -- Hashing ------------------------------------------------------------- */
+
+/* 64x64 -> 128 bit multiply, low half in a and high half in b */
+static inline void cvec_mum(uint64_t* a, uint64_t* b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t cvec_mix(uint64_t a, uint64_t b)
+{
+    cvec_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t cvec_r8(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t cvec_r4(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* wyhash: 48 bytes per round over three independent lanes, short inputs
+** are read with a few overlapping loads */
+uint64_t cvec_hash(const void* key, size_t n, uint64_t seed)
+{
+    static const uint64_t s[4] = {
+        0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+        0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+    };
+    const uint8_t* p = key;
+    uint64_t a, b;
+
+    seed ^= cvec_mix(seed ^ s[0], s[1]);
+
+    if(n <= 16)
+    {
+        if(n >= 4)
+        {
+            a = (cvec_r4(p) << 32) | cvec_r4(p + ((n >> 3) << 2));
+            b = (cvec_r4(p + n - 4) << 32) | cvec_r4(p + n - 4 - ((n >> 3) << 2));
+        }
+        else if(n > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t i = n;
+
+        if(i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = cvec_mix(cvec_r8(p) ^ s[1], cvec_r8(p + 8) ^ seed);
+                see1 = cvec_mix(cvec_r8(p + 16) ^ s[2], cvec_r8(p + 24) ^ see1);
+                see2 = cvec_mix(cvec_r8(p + 32) ^ s[3], cvec_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            }
+            while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+
+        while(i > 16)
+        {
+            seed = cvec_mix(cvec_r8(p) ^ s[1], cvec_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = cvec_r8(p + i - 16);
+        b = cvec_r8(p + i - 8);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+    cvec_mum(&a, &b);
+
+    return cvec_mix(a ^ s[0] ^ n, b ^ s[1]);
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+/*
+** C vector operations
+** tea_cvec.h
+*/
+
+#ifndef _TEA_CVEC_H
+#define _TEA_CVEC_H
+
+#include <tea.h>
+
+#include "ctype.h"
+
+void cvec_sum(tea_State* T, CType* ct, const void* p, size_t n);
+void cvec_dot(tea_State* T, CType* ct, const void* a, const void* b, size_t n);
+size_t cvec_extreme(CType* ct, const void* p, size_t n, bool max);
+size_t cvec_count_eq(CType* ct, const void* p, size_t n, const void* v);
+void cvec_copy_strided(void* dst, size_t dstride, const void* src, size_t sstride, size_t n, size_t size);
+uint64_t cvec_hash(const void* p, size_t n, uint64_t seed);
+size_t cvec_find(const void* p, size_t n, const void* needle, size_t m);
+size_t cvec_strnlen(const char* p, size_t max);
+void cvec_fill_pattern(void* dst, size_t n, const void* pat, size_t m);
+
+#endif
\ No newline at end of file
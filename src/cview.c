@@ -0,0 +1,42 @@
+/*
+** Read-only byte views
+** tea_cview.c
+*/
+
+#include "tea_ffi.h"
+#include "cview.h"
+
+CView* cview_new(tea_State* T, const char* ptr, size_t len, int owner)
+{
+    CView* v = tea_new_udatav(T, sizeof(CView), 1, VIEW_MT);
+    v->ptr = ptr;
+    v->len = len;
+
+    /* Relative owner indices moved down by the new view */
+    tea_push_value(T, owner < 0 ? owner - 1 : owner);
+    tea_set_udvalue(T, -2, 0);
+
+    return v;
+}
+
+/* Bytes of a view or a string argument */
+bool cview_bytes(tea_State* T, int idx, const char** p, size_t* len)
+{
+    CView* v;
+
+    if(tea_is_string(T, idx))
+    {
+        *p = tea_get_lstring(T, idx, len);
+        return true;
+    }
+
+    v = tea_test_udata(T, idx, VIEW_MT);
+    if(v)
+    {
+        *p = v->ptr;
+        *len = v->len;
+        return true;
+    }
+
+    return false;
+}
\ No newline at end of file
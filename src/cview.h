@@ -0,0 +1,24 @@
+/*
+** Read-only byte views
+** tea_cview.h
+*/
+
+#ifndef _TEA_CVIEW_H
+#define _TEA_CVIEW_H
+
+#include <stdbool.h>
+
+#include <tea.h>
+
+/* A view over (pointer, length). The viewed string or cdata is pinned in
+** the first user value, nothing is copied until tostring */
+typedef struct CView
+{
+    const char* ptr;
+    size_t len;
+} CView;
+
+CView* cview_new(tea_State* T, const char* ptr, size_t len, int owner);
+bool cview_bytes(tea_State* T, int idx, const char** p, size_t* len);
+
+#endif
\ No newline at end of file
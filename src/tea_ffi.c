@@ -3,6 +3,8 @@
 ** tea_ffi.c
 */
 
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <ffi.h>
@@ -20,6 +22,12 @@
 #include "cdata.h"
 #include "cparse.h"
 #include "cconv.h"
+#include "cvec.h"
+#include "csort.h"
+#include "csoa.h"
+#include "cmem.h"
+#include "cbuf.h"
+#include "cview.h"
 
 const char* crecord_registry;
 const char* carray_registry;
@@ -27,6 +35,9 @@ const char* cfunc_registry;
 const char* ctype_registry;
 const char* ctdef_registry;
 const char* clib_registry;
+const char* cmeta_registry;
+const char* cmethod_registry;
+const char* cmem_registry;
 
 ffi_type* ffi_get_type(size_t size, bool s)
 {
@@ -43,6 +54,92 @@ ffi_type* ffi_get_type(size_t size, bool s)
     }
 }
 
+/* The record type behind a record or record pointer cdata */
+static CType* cdata_record_ct(CData* cd)
+{
+    if(cdata_type(cd) == CTYPE_RECORD)
+        return cd->ct;
+    if(ctype_ptr_to(cd->ct, CTYPE_RECORD))
+        return cd->ct->ptr;
+    return NULL;
+}
+
+/* Push the metatype entry name of a record type. Records without a
+** metatype return at once */
+static bool cdata_meta_get(tea_State* T, CType* rt, const char* name)
+{
+    if(!rt || !rt->rc->has_meta)
+        return false;
+
+    tea_get_fieldp(T, TEA_REGISTRY_INDEX, &cmeta_registry);
+    tea_push_pointer(T, rt->rc);
+    tea_get_field(T, -2);
+
+    if(tea_get_key(T, -1, name))
+    {
+        tea_replace(T, -3);
+        tea_pop(T, 1);
+        return true;
+    }
+
+    tea_pop(T, 2);
+    return false;
+}
+
+/* Call the metatype entry name of the cdata at index 0 with the first n
+** arguments, if there is one */
+static bool cdata_meta_call(tea_State* T, CData* cd, const char* name, int n)
+{
+    int i;
+
+    if(!cdata_meta_get(T, cdata_record_ct(cd), name))
+        return false;
+
+    for(i = 0; i < n; i++)
+        tea_push_value(T, i);
+    tea_call(T, n);
+    return true;
+}
+
+/* Push the metatype entry name of a record type, functions come bound
+** to the cdata at index 0. Functions are looked up once per type and
+** name, each access binds its own receiver */
+static bool cdata_method_push(tea_State* T, CType* rt, const char* name)
+{
+    tea_get_fieldp(T, TEA_REGISTRY_INDEX, &cmethod_registry);
+    tea_push_pointer(T, rt->rc);
+    tea_get_field(T, -2);
+
+    if(!tea_get_key(T, -1, name))
+    {
+        if(!cdata_meta_get(T, rt, name))
+        {
+            tea_pop(T, 2);
+            return false;
+        }
+
+        if(tea_get_type(T, -1) != TEA_TYPE_FUNCTION)
+        {
+            tea_replace(T, -3);
+            tea_pop(T, 1);
+            return true;
+        }
+
+        tea_push_value(T, -1);
+        tea_set_key(T, -3, name);
+    }
+
+    tea_new_udatav(T, 0, 2, METHOD_MT);
+    tea_push_value(T, -2);
+    tea_set_udvalue(T, -2, 0);
+    tea_push_value(T, 0);
+    tea_set_udvalue(T, -2, 1);
+
+    tea_replace(T, -4);
+    tea_pop(T, 2);
+    return true;
+}
+
 static void __cdata_tostring(tea_State* T, CData* cd)
 {
     void* ptr = (cdata_type(cd) == CTYPE_PTR) ? cdata_ptr_ptr(cd) : cdata_ptr(cd);
@@ -59,14 +156,57 @@ static void __cdata_tostring(tea_State* T, CData* cd)
 static void ffi_cdata_tostring(tea_State* T)
 {
     CData* cd = tea_check_udata(T, 0, CDATA_MT);
+    if(cdata_meta_call(T, cd, "tostring", 1))
+        return;
     __cdata_tostring(T, cd);
 }
 
+/* Push the child cache of the cdata at index 0, creating it on first use */
+static void cdata_cache_push(tea_State* T)
+{
+    tea_get_udvalue(T, 0, CDATA_CACHE);
+    if(!tea_is_map(T, -1))
+    {
+        tea_pop(T, 1);
+        tea_new_map(T);
+        tea_push_value(T, -1);
+        tea_set_udvalue(T, 0, CDATA_CACHE);
+    }
+}
+
+/* A cached child is only reused while it still views the same memory,
+** the parent pointer or the slot owner may have changed since */
+static bool cdata_cache_hit(tea_State* T, CType* ct, void* ptr)
+{
+    CData* child = tea_to_userdata(T, -1);
+
+    if(child->ptr == ptr && child->ct == ct)
+    {
+        tea_remove(T, -2);
+        return true;
+    }
+
+    tea_pop(T, 2);
+    return false;
+}
+
+/* The new child at the top of the stack pins its parent */
+static void cdata_cache_child(tea_State* T)
+{
+    tea_push_value(T, 0);
+    tea_set_udvalue(T, -2, CDATA_OWNER);
+    cdata_cache_push(T);
+    tea_push_value(T, -2);
+}
+
 static void cdata_index_ptr(tea_State* T, CData* cd, CType* ct, bool to)
 {
     void* ptr = (cdata_type(cd) == CTYPE_PTR) ? cdata_ptr_ptr(cd) : cdata_ptr(cd);
     int idx;
 
+    if(!ptr)
+        tea_error(T, "NULL pointer access");
+
     if(ct->type == CTYPE_VOID)
     {
         ctype_tostring(T, cd->ct);
@@ -83,21 +223,23 @@ static void cdata_index_ptr(tea_State* T, CData* cd, CType* ct, bool to)
 
     if(to)
     {
-        tea_get_fieldp(T, TEA_REGISTRY_INDEX, cd);
-        if(tea_get_fieldi(T, -1, idx))
+        void* elem = ((char*)ptr) + ctype_sizeof(ct) * idx;
+        int slot = idx & (CDATA_CACHE_SLOTS - 1);
+
+        if(ct->type == CTYPE_RECORD || ct->type == CTYPE_ARRAY || ct->type == CTYPE_PTR)
         {
-            tea_remove(T, -2);
-            return;
+            tea_get_udvalue(T, 0, CDATA_CACHE);
+            if(tea_is_map(T, -1) && tea_get_fieldi(T, -1, slot) && cdata_cache_hit(T, ct, elem))
+                return;
+            tea_set_top(T, 2);
         }
-        tea_pop(T, 1);
 
-        cconv_tea_cdata(T, ct, ((char*)ptr) + ctype_sizeof(ct) * idx);
+        cconv_tea_cdata(T, ct, elem);
 
         if(tea_test_udata(T, -1, CDATA_MT))
         {
-            tea_get_fieldp(T, TEA_REGISTRY_INDEX, cd);
-            tea_push_value(T, -2);
-            tea_set_fieldi(T, -2, idx);
+            cdata_cache_child(T);
+            tea_set_fieldi(T, -2, slot);
             tea_pop(T, 1);
         }
         return;
@@ -141,35 +283,6 @@ static void ffi_cdata_setindex(tea_State* T)
     cdata_index_common(T, false);
 }
 
-static CRecordField* cdata_crecord_find_field(
-        CRecordField** fields, int nfield, const char* name, size_t* offset)
-{
-    int i;
-    for(i = 0; i < nfield; i++)
-    {
-        CRecordField* field = fields[i];
-
-        if(field->name[0])
-        {
-            if(!strcmp(field->name, name))
-            {
-                *offset += field->offset;
-                return field;
-            }
-        }
-        else
-        {
-            field = cdata_crecord_find_field(field->ct->rc->fields, field->ct->rc->nfield, name, offset);
-            if(field)
-            {
-                *offset += fields[i]->offset;
-                return field;
-            }
-        }
-    }
-    return NULL;
-}
-
 static void cdata_index_crecord(tea_State* T, CData* cd, CType* ct, bool to)
 {
     void* ptr = (cdata_type(cd) == CTYPE_PTR) ? cdata_ptr_ptr(cd) : cdata_ptr(cd);
@@ -180,20 +293,15 @@ static void cdata_index_crecord(tea_State* T, CData* cd, CType* ct, bool to)
 
     name = tea_check_string(T, 1);
 
-    if(to)
+    field = crecord_find_field(rc->fields, rc->nfield, name, &offset);
+    if(field && !ptr)
+        tea_error(T, "NULL pointer access");
+    if(!field)
     {
-        tea_get_fieldp(T, TEA_REGISTRY_INDEX, cd);
-        if(tea_get_key(T, -1, name))
-        {
-            tea_remove(T, -2);
+        /* Names of members never get here */
+        if(to && rc->has_meta && cdata_method_push(T, ct, name))
             return;
-        }
-        tea_pop(T, 1);
-    }
 
-    field = cdata_crecord_find_field(rc->fields, rc->nfield, name, &offset);
-    if(!field)
-    {
         ctype_tostring(T, ct);
         tea_error(T, "ctype '%s' has no member named '%s'", tea_get_string(T, -1), name);
         return;
@@ -201,11 +309,21 @@ static void cdata_index_crecord(tea_State* T, CData* cd, CType* ct, bool to)
 
     if(to)
     {
-        cconv_tea_cdata(T, field->ct, ((char*)(ptr)) + offset);
+        void* elem = ((char*)(ptr)) + offset;
+        CType* et = field->ct;
+
+        if(et->type == CTYPE_RECORD || et->type == CTYPE_ARRAY || et->type == CTYPE_PTR)
+        {
+            tea_get_udvalue(T, 0, CDATA_CACHE);
+            if(tea_is_map(T, -1) && tea_get_key(T, -1, name) && cdata_cache_hit(T, et, elem))
+                return;
+            tea_set_top(T, 2);
+        }
+
+        cconv_tea_cdata(T, et, elem);
         if(tea_test_udata(T, -1, CDATA_MT))
         {
-            tea_get_fieldp(T, TEA_REGISTRY_INDEX, cd);
-            tea_push_value(T, -2);
+            cdata_cache_child(T);
             tea_set_key(T, -2, name);
             tea_pop(T, 1);
         }
@@ -261,10 +379,17 @@ static void ffi_cdata_eq(tea_State* T)
     CData* a;
     bool eq = false;
 
+    if(cdata_meta_call(T, cd, "==", 2))
+        return;
+
     switch(type)
     {
     case CTYPE_RECORD:
     case CTYPE_ARRAY:
+        a = tea_test_udata(T, 1, CDATA_MT);
+        if(a && ctype_equal(a->ct, cd->ct))
+            eq = cdata_equal(cd->ct, cdata_ptr(cd), cdata_ptr(a));
+        break;
     case CTYPE_FUNC:
         break;
     case CTYPE_PTR:
@@ -440,7 +565,9 @@ static void ffi_cdata_call(tea_State* T)
                 break;
             case TEA_TYPE_USERDATA:
                 cd = tea_test_udata(T, i + 1, CDATA_MT);
-                if(!cd)
+                if(!cd && tea_test_udata(T, i + 1, BUFFER_MT))
+                    *(void**)values[i] = ((CBuffer*)tea_to_userdata(T, i + 1))->data;
+                else if(!cd)
                     *(void**)values[i] = tea_to_userdata(T, i + 1);
                 else if(cdata_type(cd) == CTYPE_RECORD || cdata_type(cd) == CTYPE_ARRAY)
                     *(void**)values[i] = cdata_ptr(cd);
@@ -496,26 +623,95 @@ static void ffi_cdata_call(tea_State* T)
     tea_error(T, "unsupported return type '%s'", ctype_name(rtype));
 }
 
+/* libc free as a finalizer is called directly instead of entering the
+** interpreter */
+static bool cdata_free_finalizer(CData* fin)
+{
+    CFunc* func;
+
+    if(cdata_type(fin) != CTYPE_FUNC || cdata_ptr_ptr(fin) != (void*)free)
+        return false;
+
+    func = fin->ct->func;
+    return !func->va && func->narg == 1 && func->args[0]->type == CTYPE_PTR
+        && func->rtype->type == CTYPE_VOID;
+}
+
 static void ffi_cdata_gc(tea_State* T)
 {
     CData* cd = tea_check_udata(T, 0, CDATA_MT);
+    CData* fin;
 
-    tea_get_udvalue(T, 0, 0);
-    if(!tea_is_nil(T, -1))
+    tea_get_udvalue(T, 0, CDATA_FINALIZER);
+    fin = tea_test_udata(T, -1, CDATA_MT);
+    if(fin && cdata_type(cd) == CTYPE_PTR && cdata_free_finalizer(fin))
+    {
+        free(cdata_ptr_ptr(cd));
+    }
+    else if(!tea_is_nil(T, -1))
     {
         tea_push_value(T, 0);
         tea_pcall(T, 1);
         tea_pop(T, 1);
     }
 
-    tea_push_pointer(T, cd);
-    tea_delete_field(T, TEA_REGISTRY_INDEX);
+    if(cd->ext)
+        cmem_extern_sub(T, cd->ext);
 
     tea_push_nil(T);
 }
 
+/* Binary operators only exist through metatypes */
+static void cdata_meta_binop(tea_State* T, const char* op)
+{
+    CData* cd = tea_test_udata(T, 0, CDATA_MT);
+    CData* b = tea_test_udata(T, 1, CDATA_MT);
+
+    /* The right operand is tried when the left one has no entry,
+    ** as for a scalar cdata times a record */
+    if((cd && cdata_meta_get(T, cdata_record_ct(cd), op))
+        || (b && cdata_meta_get(T, cdata_record_ct(b), op)))
+    {
+        tea_push_value(T, 0);
+        tea_push_value(T, 1);
+        tea_call(T, 2);
+        return;
+    }
+
+    if(!cd)
+        cd = tea_check_udata(T, 1, CDATA_MT);
+
+    ctype_tostring(T, cd->ct);
+    tea_error(T, "no operator '%s' for ctype '%s'", op, tea_get_string(T, -1));
+}
+
+#define CDATA_BINOP(name, op) \
+    static void name(tea_State* T) \
+    { \
+        cdata_meta_binop(T, op); \
+    }
+
+CDATA_BINOP(ffi_cdata_add, "+")
+CDATA_BINOP(ffi_cdata_sub, "-")
+CDATA_BINOP(ffi_cdata_mul, "*")
+CDATA_BINOP(ffi_cdata_div, "/")
+CDATA_BINOP(ffi_cdata_mod, "%")
+CDATA_BINOP(ffi_cdata_lt, "<")
+CDATA_BINOP(ffi_cdata_le, "<=")
+CDATA_BINOP(ffi_cdata_gt, ">")
+CDATA_BINOP(ffi_cdata_ge, ">=")
+
 static const tea_Methods cdata_methods[] = {
     { "==", "static", ffi_cdata_eq, 2, 0 },
+    { "+", "static", ffi_cdata_add, 2, 0 },
+    { "-", "static", ffi_cdata_sub, 2, 0 },
+    { "*", "static", ffi_cdata_mul, 2, 0 },
+    { "/", "static", ffi_cdata_div, 2, 0 },
+    { "%", "static", ffi_cdata_mod, 2, 0 },
+    { "<", "static", ffi_cdata_lt, 2, 0 },
+    { "<=", "static", ffi_cdata_le, 2, 0 },
+    { ">", "static", ffi_cdata_gt, 2, 0 },
+    { ">=", "static", ffi_cdata_ge, 2, 0 },
     { "call", "method", ffi_cdata_call, TEA_VARG, 0 },
     { "[]", "method", ffi_cdata_getindex, 2, 0 },
     { "[]=", "method", ffi_cdata_setindex, 3, 0 },
@@ -526,6 +722,52 @@ static const tea_Methods cdata_methods[] = {
     { NULL, NULL }
 };
 
+/* A metatype function bound to its cdata, called with the cdata first */
+static void ffi_method_call(tea_State* T)
+{
+    int i, n = tea_get_top(T) - 1;
+
+    tea_check_udata(T, 0, METHOD_MT);
+    tea_get_udvalue(T, 0, 0);
+    tea_get_udvalue(T, 0, 1);
+    for(i = 1; i <= n; i++)
+        tea_push_value(T, i);
+    tea_call(T, n + 1);
+}
+
+static const tea_Methods method_methods[] = {
+    { "call", "method", ffi_method_call, TEA_VARG, 0 },
+    { NULL, NULL }
+};
+
+/* Allocate a ct and initialize it from the optional value at index first */
+static void cnew_ctype(tea_State* T, CType* ct, size_t align, bool zero, int first)
+{
+    int ninit = tea_get_top(T) - first;
+    CData* cd = cdata_new_uninit(T, ct, align);
+    size_t size = ctype_sizeof(ct);
+
+    if(ninit == 1)
+    {
+        if(zero)
+        {
+            size_t covered = cconv_init_size(T, ct, first);
+            memset((char*)cdata_ptr(cd) + covered, 0, size - covered);
+        }
+        cconv_cdata_tea(T, cd->ct, cdata_ptr(cd), first, false);
+    }
+    else if(ninit <= 0)
+    {
+        if(zero)
+            memset(cdata_ptr(cd), 0, size);
+    }
+    else
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "too many initializers for '%s'", tea_get_string(T, -1));
+    }
+}
+
 static void ffi_ctype_tostring(tea_State* T)
 {
     CType* ct = tea_check_udata(T, 0, CTYPE_MT);
@@ -546,13 +788,29 @@ static void ffi_ctype_gc(tea_State* T)
         for(i = 0; i < ct->rc->nfield; i++)
             free(ct->rc->fields[i]);
 
+        free(ct->rc->init);
         free(ct->rc);
     }
 
     tea_push_nil(T);
 }
 
+/* Calling a ctype constructs it like ffi.cnew, without parsing the type */
+static void ffi_ctype_call(tea_State* T)
+{
+    CType* ct = tea_check_udata(T, 0, CTYPE_MT);
+
+    if(ct->type == CTYPE_VOID || ct->type == CTYPE_FUNC || ctype_sizeof(ct) == 0)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "cannot construct ctype '%s'", tea_get_string(T, -1));
+    }
+
+    cnew_ctype(T, ct, 0, true, 1);
+}
+
 static const tea_Methods ctype_methods[] = {
+    { "call", "method", ffi_ctype_call, TEA_VARG, 0 },
     { "tostring", "method", ffi_ctype_tostring, 1, 0 },
     { "gc", "method", ffi_ctype_gc, 1, 0 },
     { NULL, NULL }
@@ -613,286 +871,2059 @@ static const tea_Methods clib_methods[] = {
     { NULL, NULL }
 };
 
-static void ffi_cdef(tea_State* T)
+static CType* soa_check_field(tea_State* T, CSoa* s, int idx, int* col, size_t* offset)
 {
-    size_t len;
-    const char* str = tea_check_lstring(T, 0, &len);
-    cparse_decl(T, str, len);
+    const char* name = tea_check_string(T, idx);
+    CType* ct = csoa_field(s, name, col, offset);
+
+    if(!ct)
+    {
+        ctype_tostring(T, s->ct);
+        tea_error(T, "ctype '%s' has no member named '%s'", tea_get_string(T, -1), name);
+    }
+
+    return ct;
 }
 
-static void ffi_load(tea_State* T)
+static void ffi_soa_getindex(tea_State* T)
 {
-    const char* path = tea_check_string(T, 0);
-    bool global = tea_opt_bool(T, 1, false);
-    clib_load(T, path, global);
+    CSoa* s = tea_check_udata(T, 0, SOA_MT);
+    tea_Integer idx = tea_check_integer(T, 1);
+    CSoaRow* row;
+
+    tea_arg_check(T, idx >= 0 && idx < s->n, 1, "index out of range");
+
+    row = tea_new_udatav(T, sizeof(CSoaRow), 1, SOAROW_MT);
+    row->soa = s;
+    row->idx = idx;
+
+    tea_push_value(T, 0);
+    tea_set_udvalue(T, -2, 0);
 }
 
-static void ffi_cnew(tea_State* T)
+static void ffi_soa_setindex(tea_State* T)
 {
-    bool va = true;
-    CType* ct = cparse_single(T, &va, false);
-    CData* cd = cdata_new(T, ct, NULL);
-    int idx = va ? 3 : 2;
-    int ninit;
+    CSoa* s = tea_check_udata(T, 0, SOA_MT);
+    tea_Integer idx = tea_check_integer(T, 1);
+    CRecord* rc = s->ct->rc;
+    CData* cd;
+    int i;
 
-    ninit = tea_get_top(T) - idx;
+    tea_arg_check(T, idx >= 0 && idx < s->n, 1, "index out of range");
 
-    if(ninit == 1)
+    if(tea_get_type(T, 2) == TEA_TYPE_MAP)
     {
-        cconv_cdata_tea(T, cd->ct, cdata_ptr(cd), idx - 1, false);
+        for(i = 0; i < rc->nfield; i++)
+        {
+            CRecordField* field = rc->fields[i];
+
+            if(tea_get_key(T, 2, field->name))
+            {
+                cconv_cdata_tea(T, field->ct, csoa_ptr(s, i, idx, 0), -1, false);
+                tea_pop(T, 1);
+            }
+        }
+        return;
     }
-    else if(ninit != 0)
+
+    cd = tea_test_udata(T, 2, CDATA_MT);
+    if(cd && ctype_equal(cd->ct, s->ct))
     {
-        ctype_tostring(T, ct);
-        tea_error(T, "too many initializers for '%s'", tea_get_string(T, -1));
+        for(i = 0; i < rc->nfield; i++)
+        {
+            CRecordField* field = rc->fields[i];
+            memcpy(csoa_ptr(s, i, idx, 0), (char*)cdata_ptr(cd) + field->offset, ctype_sizeof(field->ct));
+        }
+        return;
     }
+
+    ctype_tostring(T, s->ct);
+    tea_push_fstring(T, "cannot convert '%s' to '%s'", tea_typeof(T, 2), tea_get_string(T, -1));
+    tea_arg_error(T, 2, tea_get_string(T, -1));
 }
 
-static void ffi_cast(tea_State* T)
+/* Columns are returned as array cdata over the column memory */
+static void ffi_soa_getattr(tea_State* T)
 {
-    CType* ct = cparse_single(T, NULL, false);
-    CData* cd = cdata_new(T, ct, NULL);
-    cconv_cdata_tea(T, ct, cdata_ptr(cd), 1, true);
+    CSoa* s = tea_check_udata(T, 0, SOA_MT);
+    const char* name = tea_check_string(T, 1);
+    CType match = { .type = CTYPE_ARRAY };
+    size_t offset;
+    CType* ct;
+    int col;
+
+    tea_get_udvalue(T, 0, CSOA_COLUMNS);
+    if(tea_is_map(T, -1) && tea_get_key(T, -1, name))
+    {
+        tea_remove(T, -2);
+        return;
+    }
+    tea_pop(T, 1);
+
+    ct = soa_check_field(T, s, 1, &col, &offset);
+    if(!s->ct->rc->fields[col]->name[0])
+        tea_error(T, "member '%s' is not stored as a column", name);
+
+    match.array = carray_lookup(T, s->n, ct);
+    ct = ctype_lookup(T, &match, false);
+    cdata_new(T, ct, csoa_column(s, col));
+
+    /* The column lives in the SoA, keep it alive */
+    tea_push_value(T, 0);
+    tea_set_udvalue(T, -2, CDATA_OWNER);
+
+    tea_get_udvalue(T, 0, CSOA_COLUMNS);
+    if(!tea_is_map(T, -1))
+    {
+        tea_pop(T, 1);
+        tea_new_map(T);
+        tea_push_value(T, -1);
+        tea_set_udvalue(T, 0, CSOA_COLUMNS);
+    }
+    tea_push_value(T, -2);
+    tea_set_key(T, -2, name);
+    tea_pop(T, 1);
 }
 
-static void ffi_sizeof(tea_State* T)
+static void ffi_soa_tostring(tea_State* T)
 {
-    CType* ct = cparse_single(T, NULL, false);
-    tea_push_integer(T, ctype_sizeof(ct));
+    CSoa* s = tea_check_udata(T, 0, SOA_MT);
+    csoa_tostring(T, s);
 }
 
-static void ffi_offsetof(tea_State* T)
-{
-    CType* ct = cparse_single(T, NULL, false);
-    char const* name = tea_check_string(T, 1);
-    CRecordField** fields;
-    int i;
+static const tea_Methods soa_methods[] = {
+    { "[]", "method", ffi_soa_getindex, 2, 0 },
+    { "[]=", "method", ffi_soa_setindex, 3, 0 },
+    { "getattr", "method", ffi_soa_getattr, 2, 0 },
+    { "tostring", "method", ffi_soa_tostring, 1, 0 },
+    { NULL, NULL }
+};
 
-    if(ct->type != CTYPE_RECORD)
-        return;
+static void soarow_attr_common(tea_State* T, bool to)
+{
+    CSoaRow* row = tea_check_udata(T, 0, SOAROW_MT);
+    size_t offset;
+    CType* ct;
+    int col;
 
-    fields = ct->rc->fields;
+    ct = soa_check_field(T, row->soa, 1, &col, &offset);
 
-    for(i = 0; i < ct->rc->nfield; i++)
+    if(to)
     {
-        if(!strcmp(fields[i]->name, name))
+        cconv_tea_cdata(T, ct, csoa_ptr(row->soa, col, row->idx, offset));
+        if(tea_test_udata(T, -1, CDATA_MT))
         {
-            tea_push_integer(T, fields[i]->offset);
-            return;
+            tea_push_value(T, 0);
+            tea_set_udvalue(T, -2, CDATA_OWNER);
         }
     }
-
-    tea_push_nil(T);
+    else
+        cconv_cdata_tea(T, ct, csoa_ptr(row->soa, col, row->idx, offset), 2, false);
 }
 
-static void ffi_alignof(tea_State* T)
+static void ffi_soarow_getattr(tea_State* T)
 {
-    CType* ct = cparse_single(T, NULL, false);
-    unsigned short align = ctype_ft(ct)->alignment;
-    tea_push_integer(T, align);
+    soarow_attr_common(T, true);
 }
 
-static void ffi_istype(tea_State* T)
+static void ffi_soarow_setattr(tea_State* T)
 {
-    CType* ct = cparse_single(T, NULL, false);
-    CData* cd = tea_check_udata(T, 1, CDATA_MT);
-    tea_push_bool(T, ct == cd->ct);
+    soarow_attr_common(T, false);
 }
 
-static void ffi_typeof(tea_State* T)
+static void ffi_soarow_tostring(tea_State* T)
 {
-    cparse_single(T, NULL, true);
+    CSoaRow* row = tea_check_udata(T, 0, SOAROW_MT);
+    csoa_tostring(T, row->soa);
+    tea_push_fstring(T, "[%d]", (int)row->idx);
+    tea_concat(T, 2);
 }
 
-static void ffi_addressof(tea_State* T)
+static const tea_Methods soarow_methods[] = {
+    { "getattr", "method", ffi_soarow_getattr, 2, 0 },
+    { "setattr", "method", ffi_soarow_setattr, 3, 0 },
+    { "tostring", "method", ffi_soarow_tostring, 1, 0 },
+    { NULL, NULL }
+};
+
+static void ffi_mmap_tostring(tea_State* T)
 {
-    CData* cd = tea_check_udata(T, 0, CDATA_MT);
-    CType match = {
-        .type = CTYPE_PTR,
-        .ptr = cd->ct
-    };
-    CType* ct = ctype_lookup(T, &match, false);
-    cdata_ptr_set(cdata_new(T, ct, NULL), cdata_ptr(cd));
+    CMapping* m = tea_check_udata(T, 0, MMAP_MT);
+    cmem_tostring(T, m);
 }
 
-static void ffi_gc(tea_State* T)
+static void mmap_release(tea_State* T, CMapping* m)
 {
-    tea_check_udata(T, 0, CDATA_MT);
-    tea_set_udvalue(T, 0, 0);
+    if(m->base)
+        cmem_extern_sub(T, m->size);
+    cmem_unmap(m);
 }
 
-static void ffi_tonumber(tea_State* T)
+static void ffi_mmap_gc(tea_State* T)
 {
-    CData* cd = tea_check_udata(T, 0, CDATA_MT);
-    CType* ct = cd->ct;
+    CMapping* m = tea_check_udata(T, 0, MMAP_MT);
+    mmap_release(T, m);
 
-    if(ct->type < CTYPE_VOID)
-        cconv_tea_cdata(T, ct, cdata_ptr(cd));
-    else
-        tea_push_nil(T);
+    tea_push_nil(T);
 }
 
+static const tea_Methods mmap_methods[] = {
+    { "tostring", "method", ffi_mmap_tostring, 1, 0 },
+    { "gc", "method", ffi_mmap_gc, 1, 0 },
+    { NULL, NULL }
+};
+
+static void ffi_cdef(tea_State* T)
+{
+    size_t len;
+    const char* str = tea_check_lstring(T, 0, &len);
+    cparse_decl(T, str, len);
+}
+
+static void ffi_load(tea_State* T)
+{
+    const char* path = tea_check_string(T, 0);
+    bool global = tea_opt_bool(T, 1, false);
+    clib_load(T, path, global);
+}
+
+/* Only the bytes the initializer does not cover are zeroed, uninitialized
+** allocations skip the zeroing altogether */
+static void cnew_common(tea_State* T, size_t align, bool zero)
+{
+    bool va = true;
+    CType* ct = cparse_single(T, &va, false);
+
+    cnew_ctype(T, ct, align, zero, va ? 2 : 1);
+}
+
+static void ffi_cnew(tea_State* T)
+{
+    cnew_common(T, 0, true);
+}
+
+static void ffi_cnew_aligned(tea_State* T)
+{
+    tea_Integer align = tea_check_integer(T, 1);
+
+    tea_arg_check(T, align > 0 && align <= 0x8000 && !(align & (align - 1)), 1,
+                "alignment must be a power of 2");
+    tea_remove(T, 1);
+
+    cnew_common(T, align, true);
+}
+
+static void ffi_cnew_uninit(tea_State* T)
+{
+    cnew_common(T, 0, false);
+}
+
+/* Casts only produce scalars and pointers, which the conversion overwrites */
+static void ffi_cast(tea_State* T)
+{
+    CType* ct = cparse_single(T, NULL, false);
+    CData* cd = cdata_new_uninit(T, ct, 0);
+    cconv_cdata_tea(T, ct, cdata_ptr(cd), 1, true);
+}
+
+static void ffi_soa(tea_State* T)
+{
+    CType* ct = cparse_single(T, NULL, false);
+    tea_Integer n = tea_check_integer(T, 1);
+
+    if(ct->type != CTYPE_RECORD)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' is not a struct or union", tea_get_string(T, -1));
+    }
+
+    tea_arg_check(T, n > 0, 1, "size must great than 0");
+
+    csoa_new(T, ct, n);
+}
+
+static void ffi_sizeof(tea_State* T)
+{
+    CType* ct = cparse_single(T, NULL, false);
+    tea_push_integer(T, ctype_sizeof(ct));
+}
+
+static void ffi_offsetof(tea_State* T)
+{
+    CType* ct = cparse_single(T, NULL, false);
+    char const* name = tea_check_string(T, 1);
+    CRecordField** fields;
+    int i;
+
+    if(ct->type != CTYPE_RECORD)
+        return;
+
+    fields = ct->rc->fields;
+
+    for(i = 0; i < ct->rc->nfield; i++)
+    {
+        if(!strcmp(fields[i]->name, name))
+        {
+            tea_push_integer(T, fields[i]->offset);
+            return;
+        }
+    }
+
+    tea_push_nil(T);
+}
+
+static void ffi_alignof(tea_State* T)
+{
+    CType* ct = cparse_single(T, NULL, false);
+    CData* cd = tea_test_udata(T, 0, CDATA_MT);
+    size_t align = ctype_ft(ct)->alignment;
+
+    if(cd && cd->align > align)
+        align = cd->align;
+
+    tea_push_integer(T, align);
+}
+
+static void ffi_istype(tea_State* T)
+{
+    CType* ct = cparse_single(T, NULL, false);
+    CData* cd = tea_check_udata(T, 1, CDATA_MT);
+    tea_push_bool(T, ct == cd->ct);
+}
+
+static void ffi_typeof(tea_State* T)
+{
+    cparse_single(T, NULL, true);
+}
+
+static void ffi_addressof(tea_State* T)
+{
+    CData* cd = tea_check_udata(T, 0, CDATA_MT);
+    CType match = {
+        .type = CTYPE_PTR,
+        .ptr = cd->ct
+    };
+    CType* ct = ctype_lookup(T, &match, false);
+    cdata_ptr_set(cdata_new(T, ct, NULL), cdata_ptr(cd));
+}
+
+/* An optional size tells the collector how much memory the finalizer
+** releases, so large foreign buffers get collected in time */
+static void ffi_gc(tea_State* T)
+{
+    CData* cd = tea_check_udata(T, 0, CDATA_MT);
+    tea_Integer size = tea_opt_integer(T, 2, 0);
+
+    tea_arg_check(T, size >= 0, 2, "size must be non-negative");
+    tea_set_top(T, 2);
+
+    if(cd->ext)
+    {
+        cmem_extern_sub(T, cd->ext);
+        cd->ext = 0;
+    }
+
+    if(!tea_is_nil(T, 1))
+    {
+        cd->ext = size;
+        cmem_extern_add(T, size);
+    }
+
+    tea_set_udvalue(T, 0, CDATA_FINALIZER);
+}
+
+/* The total includes frees still queued for the next batch */
+static void ffi_extmem(tea_State* T)
+{
+    if(!tea_is_nonenil(T, 0))
+    {
+        tea_Integer step = tea_check_integer(T, 0);
+        tea_arg_check(T, step > 0, 0, "step must be positive");
+        cmem_extern_step(T, step);
+    }
+
+    tea_push_integer(T, cmem_extern_total(T));
+}
+
+static void ffi_tonumber(tea_State* T)
+{
+    CData* cd = tea_check_udata(T, 0, CDATA_MT);
+    CType* ct = cd->ct;
+
+    if(ct->type < CTYPE_VOID)
+        cconv_tea_cdata(T, ct, cdata_ptr(cd));
+    else
+        tea_push_nil(T);
+}
+
+/* Strings up to the first NUL, at most the array size and the optional
+** maxlen. An explicit length copies exactly that many bytes */
 static void ffi_string(tea_State* T)
 {
-    CData* cd = tea_check_udata(T, 0, CDATA_MT);
-    CArray* array = NULL;
-    CType* ct = cd->ct;
-    const char* ptr = (ct->type == CTYPE_PTR) ? cdata_ptr_ptr(cd) : cdata_ptr(cd);
+    CData* cd = tea_check_udata(T, 0, CDATA_MT);
+    CArray* array = NULL;
+    CType* ct = cd->ct;
+    const char* ptr = (ct->type == CTYPE_PTR) ? cdata_ptr_ptr(cd) : cdata_ptr(cd);
+    size_t len, max = SIZE_MAX;
+
+    if(!ptr)
+        tea_arg_error(T, 0, "NULL pointer access");
+
+    if(!tea_is_nonenil(T, 1))
+    {
+        len = tea_check_integer(T, 1);
+
+        switch(ct->type)
+        {
+        case CTYPE_PTR:
+        case CTYPE_ARRAY:
+        case CTYPE_RECORD:
+            tea_push_lstring(T, ptr, len);
+            return;
+        default:
+            goto converr;
+        }
+    }
+
+    if(!tea_is_nonenil(T, 2))
+    {
+        tea_Integer n = tea_check_integer(T, 2);
+        tea_arg_check(T, n >= 0, 2, "length must be non-negative");
+        max = n;
+    }
+
+    switch(ct->type)
+    {
+    case CTYPE_PTR:
+        ct = ct->ptr;
+        break;
+    case CTYPE_ARRAY:
+        array = ct->array;
+        ct = array->ct;
+        break;
+    default:
+        goto converr;
+    }
+
+    switch(ct->type)
+    {
+    case CTYPE_VOID:
+    case CTYPE_CHAR:
+    case CTYPE_UCHAR:
+        break;
+    default:
+        goto converr;
+    }
+
+    if(array && array->size && array->ft.size < max)
+        max = array->ft.size;
+
+    len = cvec_strnlen(ptr, max);
+    tea_push_lstring(T, ptr, len);
+    return;
+
+converr:
+    __cdata_tostring(T, cd);
+    tea_push_fstring(T, "cannot convert '%s' to 'string'", tea_get_string(T, -1));
+    tea_arg_check(T, false, 0, tea_get_string(T, -1));
+    return;
+}
+
+/* Get the data pointer and byte size of a cdata, the size is SIZE_MAX
+** for pointers whose target length is unknown */
+static void* cdata_check_bytes(tea_State* T, int idx, size_t* size)
+{
+    CData* cd = tea_check_udata(T, idx, CDATA_MT);
+
+    switch(cdata_type(cd))
+    {
+    case CTYPE_PTR:
+    {
+        void* ptr = cdata_ptr_ptr(cd);
+        *size = ptr ? SIZE_MAX : 0;
+        return ptr;
+    }
+    case CTYPE_FUNC:
+        tea_arg_error(T, idx, "cannot access the bytes of a function");
+        return NULL;
+    default:
+        *size = ctype_sizeof(cd->ct);
+        return cdata_ptr(cd);
+    }
+}
+
+/* Hash of the value bytes without record padding, or of exactly len
+** bytes. Truncated to 53 bits so it stays exact as a number */
+static void ffi_hash(tea_State* T)
+{
+    CData* cd = tea_check_udata(T, 0, CDATA_MT);
+    size_t size;
+    void* ptr = cdata_check_bytes(T, 0, &size);
+    uint64_t h;
+
+    if(!tea_is_nonenil(T, 1))
+    {
+        tea_Integer len = tea_check_integer(T, 1);
+        tea_arg_check(T, len >= 0 && (uint64_t)len <= size, 1, "length out of range");
+        h = cvec_hash(ptr, len, 0);
+    }
+    else if(size == SIZE_MAX)
+    {
+        tea_arg_error(T, 1, "length required");
+        return;
+    }
+    else if(ctype_padded(cd->ct))
+    {
+        char buf[256];
+        char* packed = size <= sizeof(buf) ? buf : malloc(size);
+
+        if(!packed)
+            tea_error(T, "no mem");
+
+        h = cvec_hash(packed, cdata_pack(cd->ct, ptr, packed), 0);
+        if(packed != buf)
+            free(packed);
+    }
+    else
+    {
+        h = cvec_hash(ptr, size, 0);
+    }
+
+    tea_push_integer(T, h & (((uint64_t)1 << 53) - 1));
+}
+
+/* Resolve a buffer argument plus an optional byte offset at offidx, none
+** if negative. Strings are accepted as sources, destinations must be
+** writable. avail is the number of bytes after the offset, SIZE_MAX if
+** unknown */
+static char* buffer_check(tea_State* T, int idx, int offidx, bool dst, size_t* avail)
+{
+    tea_Integer off = offidx < 0 ? 0 : tea_opt_integer(T, offidx, 0);
+    size_t size;
+    char* ptr;
+
+    if(!dst && tea_is_string(T, idx))
+    {
+        ptr = (char*)tea_get_lstring(T, idx, &size);
+    }
+    else
+    {
+        CData* cd = tea_check_udata(T, idx, CDATA_MT);
+        ptr = cdata_check_bytes(T, idx, &size);
+
+        if(dst && (cd->ct->is_const || (cdata_type(cd) == CTYPE_PTR && cd->ct->ptr->is_const)))
+            tea_arg_error(T, idx, "assignment of read-only variable");
+    }
+
+    tea_arg_check(T, off >= 0 && (uint64_t)off <= size, offidx, "offset out of range");
+
+    *avail = size == SIZE_MAX ? SIZE_MAX : size - off;
+    return ptr + off;
+}
+
+/* Length argument at idx, defaulting to and bounded by avail */
+static size_t buffer_check_len(tea_State* T, int idx, size_t avail)
+{
+    tea_Integer len;
+
+    if(tea_is_nonenil(T, idx))
+    {
+        tea_arg_check(T, avail != SIZE_MAX, idx, "length required");
+        return avail;
+    }
+
+    len = tea_check_integer(T, idx);
+    tea_arg_check(T, len >= 0 && (uint64_t)len <= avail, idx, "length out of range");
+    return len;
+}
+
+static void ffi_move(tea_State* T)
+{
+    size_t davail, savail, len;
+    char* dst = buffer_check(T, 0, 3, true, &davail);
+    char* src = buffer_check(T, 1, 4, false, &savail);
+
+    len = buffer_check_len(T, 2, davail < savail ? davail : savail);
+    memmove(dst, src, len);
+
+    tea_push_integer(T, len);
+}
+
+static void ffi_compare(tea_State* T)
+{
+    size_t aavail, bavail, len;
+    char* a = buffer_check(T, 0, 3, false, &aavail);
+    char* b = buffer_check(T, 1, 4, false, &bavail);
+    int r;
+
+    len = buffer_check_len(T, 2, aavail < bavail ? aavail : bavail);
+    r = memcmp(a, b, len);
+
+    tea_push_integer(T, (r > 0) - (r < 0));
+}
+
+/* Needle is a byte value, a string or the bytes of a cdata */
+static void ffi_find(tea_State* T)
+{
+    tea_Integer off = tea_opt_integer(T, 3, 0);
+    size_t avail, len, m, i;
+    char* p = buffer_check(T, 0, 3, false, &avail);
+    const void* needle;
+    uint8_t c;
+
+    len = buffer_check_len(T, 2, avail);
+
+    if(tea_is_number(T, 1))
+    {
+        c = (uint8_t)tea_to_integer(T, 1);
+        needle = &c;
+        m = 1;
+    }
+    else
+    {
+        needle = buffer_check(T, 1, -1, false, &m);
+        tea_arg_check(T, m != SIZE_MAX, 1, "length of needle unknown");
+    }
+
+    i = cvec_find(p, len, needle, m);
+    if(i == SIZE_MAX)
+        tea_push_nil(T);
+    else
+        tea_push_integer(T, off + i);
+}
+
+static void ffi_fillpattern(tea_State* T)
+{
+    size_t avail, len, m;
+    char* dst = buffer_check(T, 0, 3, true, &avail);
+    const void* pat = buffer_check(T, 1, -1, false, &m);
+
+    tea_arg_check(T, m > 0 && m != SIZE_MAX, 1, "invalid pattern");
+    len = buffer_check_len(T, 2, avail);
+
+    cvec_fill_pattern(dst, len, pat, m);
+}
+
+/* A string source without a length is copied with its terminator */
+static void ffi_copy(tea_State* T)
+{
+    size_t davail, savail, len;
+    char* dst = buffer_check(T, 0, 3, true, &davail);
+    const char* src = buffer_check(T, 1, 4, false, &savail);
+
+    if(tea_is_nonenil(T, 2) && tea_is_string(T, 1))
+    {
+        len = savail + 1;
+        tea_arg_check(T, len <= davail, 1, "string too long for destination");
+    }
+    else
+    {
+        /* The terminator of a string source may be copied too */
+        if(tea_is_string(T, 1))
+            savail++;
+        len = buffer_check_len(T, 2, davail < savail ? davail : savail);
+    }
+
+    memcpy(dst, src, len);
+
+    tea_push_integer(T, len);
+}
+
+static void ffi_fill(tea_State* T)
+{
+    size_t avail, len;
+    char* dst = buffer_check(T, 0, 3, true, &avail);
+    int c = tea_opt_integer(T, 2, 0);
+
+    len = buffer_check_len(T, 1, avail);
+    memset(dst, c, len);
+}
+
+/* Get the element type, data pointer and element count of an array or pointer
+** cdata. The count is read from argument nidx, or is the array size (0 when
+** unknown) if nidx is negative */
+static void* cdata_check_elems(tea_State* T, int idx, int nidx, CType** ct, size_t* n)
+{
+    CData* cd = tea_check_udata(T, idx, CDATA_MT);
+    size_t size = 0;
+    void* ptr;
+
+    switch(cdata_type(cd))
+    {
+    case CTYPE_ARRAY:
+        *ct = cd->ct->array->ct;
+        size = cd->ct->array->size;
+        ptr = cdata_ptr(cd);
+        break;
+    case CTYPE_PTR:
+        *ct = cd->ct->ptr;
+        ptr = cdata_ptr_ptr(cd);
+        break;
+    default:
+        ctype_tostring(T, cd->ct);
+        tea_push_fstring(T, "ctype '%s' is not an array or pointer", tea_get_string(T, -1));
+        tea_arg_error(T, idx, tea_get_string(T, -1));
+        return NULL;
+    }
+
+    if(nidx < 0)
+    {
+        *n = size;
+    }
+    else if(tea_get_top(T) > nidx && !tea_is_nil(T, nidx))
+    {
+        tea_Integer len = tea_check_integer(T, nidx);
+        tea_arg_check(T, len >= 0 && (!size || len <= size), nidx, "length out of range");
+        *n = len;
+    }
+    else
+    {
+        tea_arg_check(T, size > 0, nidx, "length required");
+        *n = size;
+    }
+
+    if(!ptr && *n)
+        tea_arg_error(T, idx, "NULL pointer access");
+
+    return ptr;
+}
+
+static void* reduce_check_num(tea_State* T, int idx, int nidx, CType** ct, size_t* n)
+{
+    void* ptr = cdata_check_elems(T, idx, nidx, ct, n);
+    if(!ctype_is_num(*ct))
+    {
+        ctype_tostring(T, *ct);
+        tea_error(T, "cannot reduce over non-numeric ctype '%s'", tea_get_string(T, -1));
+    }
+    return ptr;
+}
+
+static void ffi_reduce_sum(tea_State* T)
+{
+    CType* ct;
+    size_t n;
+    void* ptr = reduce_check_num(T, 0, 1, &ct, &n);
+    cvec_sum(T, ct, ptr, n);
+}
+
+static void reduce_extreme(tea_State* T, bool max)
+{
+    CType* ct;
+    size_t n;
+    void* ptr = reduce_check_num(T, 0, 1, &ct, &n);
+
+    if(n == 0)
+    {
+        tea_push_nil(T);
+        return;
+    }
+
+    cconv_tea_cdata(T, ct, (char*)ptr + ctype_sizeof(ct) * cvec_extreme(ct, ptr, n, max));
+}
+
+static void ffi_reduce_min(tea_State* T)
+{
+    reduce_extreme(T, false);
+}
+
+static void ffi_reduce_max(tea_State* T)
+{
+    reduce_extreme(T, true);
+}
+
+static void ffi_reduce_argmax(tea_State* T)
+{
+    CType* ct;
+    size_t n;
+    void* ptr = reduce_check_num(T, 0, 1, &ct, &n);
+
+    if(n == 0)
+    {
+        tea_push_nil(T);
+        return;
+    }
+
+    tea_push_integer(T, cvec_extreme(ct, ptr, n, true));
+}
+
+static void ffi_reduce_dot(tea_State* T)
+{
+    CType *ct, *bct;
+    size_t n, bn;
+    void* a = reduce_check_num(T, 0, 2, &ct, &n);
+    void* b = reduce_check_num(T, 1, 2, &bct, &bn);
+
+    if(!ctype_equal(ct, bct))
+    {
+        ctype_tostring(T, ct);
+        ctype_tostring(T, bct);
+        tea_error(T, "element type mismatch '%s' and '%s'", tea_get_string(T, -2), tea_get_string(T, -1));
+    }
+
+    cvec_dot(T, ct, a, b, n < bn ? n : bn);
+}
+
+static void ffi_reduce_count_if_eq(tea_State* T)
+{
+    CType* ct;
+    size_t n;
+    void* ptr = reduce_check_num(T, 0, 2, &ct, &n);
+    void* v = alloca(ctype_sizeof(ct));
+
+    cconv_cdata_tea(T, ct, v, 1, false);
+    tea_push_integer(T, cvec_count_eq(ct, ptr, n, v));
+}
+
+static const tea_Methods reduce_methods[] = {
+    { "sum", "static", ffi_reduce_sum, 1, 1 },
+    { "min", "static", ffi_reduce_min, 1, 1 },
+    { "max", "static", ffi_reduce_max, 1, 1 },
+    { "argmax", "static", ffi_reduce_argmax, 1, 1 },
+    { "dot", "static", ffi_reduce_dot, 2, 1 },
+    { "count_if_eq", "static", ffi_reduce_count_if_eq, 2, 1 },
+    { NULL, NULL }
+};
+
+/* Resolve an optional, possibly dotted, member path of a record type */
+static CType* cdata_check_path(tea_State* T, CType* ct, int idx, size_t* offset)
+{
+    const char* path;
+    CType* fct;
+
+    *offset = 0;
+
+    if(tea_get_top(T) <= idx || tea_is_nil(T, idx))
+        return ct;
+
+    path = tea_check_string(T, idx);
+    fct = crecord_find_path(ct, path, offset);
+    if(!fct)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' has no member named '%s'", tea_get_string(T, -1), path);
+    }
+
+    return fct;
+}
+
+/* Resolve the key of a sort, the element itself or one of its record fields */
+static CType* sort_check_key(tea_State* T, CType* ct, int idx, size_t* offset)
+{
+    ct = cdata_check_path(T, ct, idx, offset);
+
+    if(!ctype_is_num(ct))
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "cannot sort by non-numeric ctype '%s'", tea_get_string(T, -1));
+    }
+
+    return ct;
+}
+
+static void ffi_sort(tea_State* T)
+{
+    CType *ct, *kt;
+    size_t n, offset;
+    void* ptr = cdata_check_elems(T, 0, 1, &ct, &n);
+    bool desc = tea_opt_bool(T, 3, false);
+
+    kt = sort_check_key(T, ct, 2, &offset);
+    csort_sort(T, ptr, n, ctype_sizeof(ct), kt, offset, desc);
+
+    tea_push_value(T, 0);
+}
+
+static void ffi_bsearch(tea_State* T)
+{
+    CType *ct, *kt;
+    size_t n, offset;
+    void* ptr = cdata_check_elems(T, 0, 1, &ct, &n);
+    ptrdiff_t i;
+    void* key;
+
+    kt = sort_check_key(T, ct, 3, &offset);
+
+    key = alloca(ctype_sizeof(kt));
+    cconv_cdata_tea(T, kt, key, 2, false);
+
+    i = csort_bsearch(ptr, n, ctype_sizeof(ct), kt, offset, key);
+    if(i < 0)
+        tea_push_nil(T);
+    else
+        tea_push_integer(T, i);
+}
+
+static void ffi_gather(tea_State* T)
+{
+    CType *ct, *ft, *dct;
+    size_t n, dn, offset, size;
+    char* base = cdata_check_elems(T, 0, 1, &ct, &n);
+    char* dst;
+    size_t i;
+
+    tea_check_string(T, 2);
+    ft = cdata_check_path(T, ct, 2, &offset);
+    size = ctype_sizeof(ft);
+    base += offset;
+
+    if(tea_get_top(T) < 4 || tea_is_nil(T, 3))
+    {
+        CType match = { .type = CTYPE_ARRAY };
+        tea_arg_check(T, n > 0, 1, "length must great than 0");
+        match.array = carray_lookup(T, n, ft);
+        dst = cdata_ptr(cdata_new(T, ctype_lookup(T, &match, false), NULL));
+        cvec_copy_strided(dst, size, base, ctype_sizeof(ct), n, size);
+        return;
+    }
+
+    if(tea_get_type(T, 3) == TEA_TYPE_LIST)
+    {
+        for(i = 0; i < n; i++)
+        {
+            cconv_tea_cdata(T, ft, base + ctype_sizeof(ct) * i);
+            tea_add_item(T, 3);
+        }
+        tea_push_value(T, 3);
+        return;
+    }
+
+    dst = cdata_check_elems(T, 3, -1, &dct, &dn);
+    tea_arg_check(T, dn == 0 || dn >= n, 3, "destination too small");
+    if(!dst && n)
+        tea_arg_error(T, 3, "NULL pointer access");
+
+    if(ctype_equal(dct, ft))
+    {
+        cvec_copy_strided(dst, size, base, ctype_sizeof(ct), n, size);
+    }
+    else
+    {
+        for(i = 0; i < n; i++)
+        {
+            cconv_tea_cdata(T, ft, base + ctype_sizeof(ct) * i);
+            cconv_cdata_tea(T, dct, dst + ctype_sizeof(dct) * i, -1, false);
+            tea_pop(T, 1);
+        }
+    }
+
+    tea_push_value(T, 3);
+}
+
+static void ffi_scatter(tea_State* T)
+{
+    CType *ct, *ft, *sct;
+    size_t n, sn, offset, size;
+    char* base = cdata_check_elems(T, 0, 1, &ct, &n);
+    char* src;
+    size_t i;
+
+    tea_check_string(T, 2);
+    ft = cdata_check_path(T, ct, 2, &offset);
+    size = ctype_sizeof(ft);
+    base += offset;
+
+    switch(tea_get_type(T, 3))
+    {
+    case TEA_TYPE_LIST:
+        for(i = 0; i < n && tea_get_item(T, 3, i); i++)
+        {
+            cconv_cdata_tea(T, ft, base + ctype_sizeof(ct) * i, -1, false);
+            tea_pop(T, 1);
+        }
+        break;
+    case TEA_TYPE_USERDATA:
+        if(tea_test_udata(T, 3, CDATA_MT) && (cdata_type(tea_to_userdata(T, 3)) == CTYPE_ARRAY
+                || cdata_type(tea_to_userdata(T, 3)) == CTYPE_PTR))
+        {
+            src = cdata_check_elems(T, 3, -1, &sct, &sn);
+            tea_arg_check(T, sn == 0 || sn >= n, 3, "source too small");
+            if(!src && n)
+                tea_arg_error(T, 3, "NULL pointer access");
+
+            if(ctype_equal(sct, ft))
+            {
+                cvec_copy_strided(base, ctype_sizeof(ct), src, size, n, size);
+            }
+            else
+            {
+                for(i = 0; i < n; i++)
+                {
+                    cconv_tea_cdata(T, sct, src + ctype_sizeof(sct) * i);
+                    cconv_cdata_tea(T, ft, base + ctype_sizeof(ct) * i, -1, false);
+                    tea_pop(T, 1);
+                }
+            }
+            break;
+        }
+        /* fallthrough */
+    default:
+        /* A single value is broadcast to every element */
+        src = alloca(size);
+        cconv_cdata_tea(T, ft, src, 3, false);
+        cvec_copy_strided(base, ctype_sizeof(ct), src, 0, n, size);
+        break;
+    }
+
+    tea_push_value(T, 0);
+}
+
+static void ffi_errno(tea_State* T)
+{
+    int cur = errno;
+
+    if(tea_get_top(T) > 0)
+        errno = tea_check_integer(T, 0);
+
+    tea_push_integer(T, cur);
+}
+
+/* Check string against a linear list of matches */
+int cparse_case(const char* str, size_t len, const char* match)
+{
+    size_t len1;
+    int n;
+    for(n = 0; (len1 = (int)*match++); n++, match += len1)
+    {
+        if(len == len1 && !memcmp(match, str, len1))
+        return n;
+    }
+    return -1;
+}
+
+static void ffi__abi(tea_State* T)
+{
+    size_t len;
+    const char* str = tea_check_lstring(T, 0, &len);
+    int b = cparse_case(str, len,
+#if FFI_64
+    "\00564bit"
+#else
+    "\00532bit"
+#endif
+#if FFI_LE
+    "\002le"
+#else
+    "\002be"
+#endif
+    ) >= 0;
+    tea_push_bool(T, b);
+}
+
+/* Make the type read-only so writes through a read-only mapping are refused */
+static CType* mapfile_const(tea_State* T, CType* ct)
+{
+    CType match = *ct;
+    match.is_const = true;
+    return ctype_lookup(T, &match, false);
+}
+
+/* Wrap the mapping at the top of the stack, the cdata keeps it alive */
+static void mapping_cdata(tea_State* T, CType* ct, void* ptr)
+{
+    CMapping* m = tea_to_userdata(T, -1);
+
+    cdata_new(T, ct, ptr);
+    tea_push_value(T, -2);
+    tea_set_udvalue(T, -2, CDATA_OWNER);
+
+    cmem_extern_add(T, m->size);
+}
+
+static void ffi_mapfile(tea_State* T)
+{
+    const char* path = tea_check_string(T, 0);
+    size_t len;
+    const char* str = tea_opt_lstring(T, 2, "r", &len);
+    tea_Integer offset = tea_opt_integer(T, 3, 0);
+    tea_Integer length = tea_opt_integer(T, 4, 0);
+    static const int modes[] = { CMEM_READ, CMEM_WRITE, CMEM_WRITE, CMEM_COPY };
+    int mode = cparse_case(str, len, "\001r\001w\002rw\001c");
+    bool flexible;
+    size_t size;
+    CMapping* m;
+    CType* ct;
+    void* ptr;
+
+    tea_arg_check(T, mode >= 0, 2, "invalid mode");
+    tea_arg_check(T, offset >= 0, 3, "offset must be non-negative");
+    tea_arg_check(T, length >= 0, 4, "length must be non-negative");
+    mode = modes[mode];
+
+    ct = cparse_flexible(T, 1, &flexible);
+    size = ctype_sizeof(ct);
+    if(size == 0)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' has no size", tea_get_string(T, -1));
+    }
+
+    /* A fixed type maps exactly its own size unless told otherwise */
+    if(!flexible && length == 0)
+        length = size;
+
+    len = length;
+    m = tea_new_udata(T, sizeof(CMapping), MMAP_MT);
+    memset(m, 0, sizeof(CMapping));
+    ptr = cmem_map_file(T, m, path, mode, offset, &len);
+
+    if(mode == CMEM_READ)
+        ct = mapfile_const(T, ct);
+
+    if(flexible)
+    {
+        CType match = { .type = CTYPE_ARRAY, .is_const = mode == CMEM_READ };
+
+        if(len < size)
+            tea_error(T, "file " TEA_QS " is too small for one element", path);
+
+        match.array = carray_lookup(T, len / size, ct);
+        ct = ctype_lookup(T, &match, false);
+    }
+    else if(len < size)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "file " TEA_QS " is too small for ctype '%s'", path, tea_get_string(T, -1));
+    }
+
+    mapping_cdata(T, ct, ptr);
+}
+
+static CMapping* cdata_check_mapping(tea_State* T, int idx)
+{
+    CMapping* m;
+
+    tea_check_udata(T, idx, CDATA_MT);
+    tea_get_udvalue(T, idx, CDATA_OWNER);
+    m = tea_test_udata(T, -1, MMAP_MT);
+    if(!m)
+        tea_arg_error(T, idx, "cdata is not a memory mapping");
+    tea_pop(T, 1);
+
+    return m;
+}
+
+/* Boolean entry of an optional options map, false when absent */
+static bool opt_flag(tea_State* T, int idx, const char* name)
+{
+    bool b = false;
+
+    if(tea_is_map(T, idx) && tea_get_key(T, idx, name))
+    {
+        b = tea_to_bool(T, -1);
+        tea_pop(T, 1);
+    }
+
+    return b;
+}
+
+static void ffi_bigalloc(tea_State* T)
+{
+    bool flexible;
+    CType* ct = cparse_flexible(T, 0, &flexible);
+    size_t size = ctype_sizeof(ct);
+    int idx = 1;
+    CMapping* m;
+    void* ptr;
+
+    if(size == 0)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' has no size", tea_get_string(T, -1));
+    }
+
+    if(flexible)
+    {
+        CType match = { .type = CTYPE_ARRAY };
+        tea_Integer n = tea_check_integer(T, 1);
+
+        tea_arg_check(T, n > 0 && (uint64_t)n <= SIZE_MAX / size, 1, "size out of range");
+
+        match.array = carray_lookup(T, n, ct);
+        ct = ctype_lookup(T, &match, false);
+        size *= n;
+        idx = 2;
+    }
+
+    if(!tea_is_nonenil(T, idx))
+        tea_check_type(T, idx, TEA_TYPE_MAP);
+
+    m = tea_new_udata(T, sizeof(CMapping), MMAP_MT);
+    memset(m, 0, sizeof(CMapping));
+    ptr = cmem_map_anon(T, m, size, opt_flag(T, idx, "hugepages"), opt_flag(T, idx, "populate"));
+
+    mapping_cdata(T, ct, ptr);
+}
+
+/* Unmapped cdata become NULL pointers to their element type */
+static void* unmapped_slot;
+
+static void mapping_invalidate(tea_State* T, int idx)
+{
+    CData* cd = tea_to_userdata(T, idx);
+    CType match = { .type = CTYPE_PTR };
+
+    switch(cdata_type(cd))
+    {
+    case CTYPE_PTR:
+        if(cd->ptr == (void*)&unmapped_slot)
+            return;
+        match.ptr = cd->ct->ptr;
+        break;
+    case CTYPE_ARRAY:
+        match.ptr = cd->ct->array->ct;
+        break;
+    default:
+        match.ptr = cd->ct;
+        break;
+    }
+
+    cd->ct = ctype_lookup(T, &match, false);
+    cd->ptr = (void*)&unmapped_slot;
+
+    /* Cached children view the same region */
+    tea_get_udvalue(T, idx, CDATA_CACHE);
+    if(tea_is_map(T, -1))
+    {
+        tea_push_nil(T);
+        while(tea_next(T, -2) != 0)
+        {
+            if(tea_test_udata(T, -1, CDATA_MT))
+                mapping_invalidate(T, tea_get_top(T) - 1);
+            tea_pop(T, 1);
+        }
+    }
+    tea_pop(T, 1);
+
+    tea_push_nil(T);
+    tea_set_udvalue(T, idx, CDATA_CACHE);
+}
+
+/* Release the mapping now. Only the mapping cdata and the children still
+** in its cache turn into NULL pointers. Cdata derived from it otherwise,
+** such as evicted children or the results of ffi.cast and ffi.addressof,
+** keep the old address and must not be used afterwards */
+static void ffi_unmap(tea_State* T)
+{
+    CMapping* m = cdata_check_mapping(T, 0);
+    mmap_release(T, m);
+    mapping_invalidate(T, 0);
+}
+
+static void ffi_madvise(tea_State* T)
+{
+    CMapping* m = cdata_check_mapping(T, 0);
+    size_t len;
+    const char* str = tea_check_lstring(T, 1, &len);
+    int advice = cparse_case(str, len,
+        "\006normal\012sequential\006random\010willneed\010dontneed");
+
+    tea_arg_check(T, advice >= 0, 1, "invalid advice");
+    cmem_advise(T, m, advice);
+}
+
+static void ffi_msync(tea_State* T)
+{
+    CMapping* m = cdata_check_mapping(T, 0);
+    cmem_sync(T, m, tea_opt_bool(T, 1, false));
+}
+
+/* Optional "le" or "be" byte order argument, true if it differs from
+** the native one */
+static bool order_check_swap(tea_State* T, int idx)
+{
+    size_t len;
+    const char* str;
+    int order;
+
+    if(tea_is_nonenil(T, idx))
+        return false;
+
+    str = tea_check_lstring(T, idx, &len);
+    order = cparse_case(str, len, "\002le\002be");
+    tea_arg_check(T, order >= 0, idx, "invalid byte order");
+
+    return order != (FFI_LE ? 0 : 1);
+}
+
+/* Pointer cdata of type uint8_t*, or const uint8_t* for read-only bytes,
+** keeping the userdata at owner alive */
+static void buffer_push_ptr(tea_State* T, const void* p, int owner, bool readonly)
+{
+    bool flexible;
+    CType* ct;
+    CData* cd;
+
+    tea_push_string(T, readonly ? "const uint8_t*" : "uint8_t*");
+    ct = cparse_flexible(T, -1, &flexible);
+    tea_pop(T, 1);
+
+    cd = cdata_new(T, ct, NULL);
+    cdata_ptr_set(cd, (void*)p);
+
+    tea_push_value(T, owner);
+    tea_set_udvalue(T, -2, CDATA_OWNER);
+}
+
+/* Append strings or the bytes of sized cdata */
+static void ffi_buffer_put(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    int i, n = tea_get_top(T);
+
+    for(i = 1; i < n; i++)
+    {
+        const char* p;
+        size_t len;
+
+        if(tea_is_string(T, i))
+        {
+            p = tea_get_lstring(T, i, &len);
+        }
+        else
+        {
+            p = cdata_check_bytes(T, i, &len);
+            tea_arg_check(T, len != SIZE_MAX, i, "length of pointer target unknown");
+        }
+
+        cbuf_put(T, b, p, len);
+    }
+
+    tea_push_value(T, 0);
+}
+
+/* Append a number in the fixed-width encoding of a numeric ctype */
+static void ffi_buffer_putnum(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    bool flexible;
+    CType* ct = cparse_flexible(T, 1, &flexible);
+    size_t size = ctype_sizeof(ct);
+    char* p;
+
+    if(flexible || !ctype_is_num(ct))
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' is not a number type", tea_get_string(T, -1));
+    }
+
+    p = cbuf_reserve(T, b, size);
+    cconv_cdata_tea(T, ct, p, 2, false);
+    if(order_check_swap(T, 3))
+        cdata_bswap(ct, p);
+    b->len += size;
+
+    tea_push_value(T, 0);
+}
+
+/* Write position with room for n bytes, for C code to fill in place */
+static void ffi_buffer_reserve(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    tea_Integer n = tea_check_integer(T, 1);
+
+    tea_arg_check(T, n >= 0, 1, "size must be non-negative");
+    buffer_push_ptr(T, cbuf_reserve(T, b, n), 0, false);
+}
+
+static void ffi_buffer_commit(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    tea_Integer n = tea_check_integer(T, 1);
+
+    tea_arg_check(T, n >= 0 && (uint64_t)n <= b->cap - b->len, 1, "size out of range");
+    b->len += n;
+
+    tea_push_value(T, 0);
+}
+
+/* Keep the storage for reuse */
+static void ffi_buffer_reset(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    b->len = 0;
+
+    tea_push_value(T, 0);
+}
+
+/* The pointer is only valid until the buffer grows */
+static void ffi_buffer_ptr(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    buffer_push_ptr(T, b->data, 0, false);
+}
+
+static void ffi_buffer_size(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    tea_push_integer(T, b->len);
+}
+
+static void ffi_buffer_tostring(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    tea_push_lstring(T, b->data ? b->data : "", b->len);
+}
+
+static void ffi_buffer_gc(tea_State* T)
+{
+    CBuffer* b = tea_check_udata(T, 0, BUFFER_MT);
+    cbuf_free(T, b);
+
+    tea_push_nil(T);
+}
+
+static const tea_Methods buffer_methods[] = {
+    { "put", "method", ffi_buffer_put, TEA_VARG, 0 },
+    { "putnum", "method", ffi_buffer_putnum, 3, 1 },
+    { "reserve", "method", ffi_buffer_reserve, 2, 0 },
+    { "commit", "method", ffi_buffer_commit, 2, 0 },
+    { "reset", "method", ffi_buffer_reset, 1, 0 },
+    { "ptr", "method", ffi_buffer_ptr, 1, 0 },
+    { "size", "method", ffi_buffer_size, 1, 0 },
+    { "tostring", "method", ffi_buffer_tostring, 1, 0 },
+    { "gc", "method", ffi_buffer_gc, 1, 0 },
+    { NULL, NULL }
+};
+
+/* Serialize a map or list in the layout of a fixed-size ctype */
+static void ffi_pack(tea_State* T)
+{
+    bool flexible;
+    CType* ct = cparse_flexible(T, 0, &flexible);
+    size_t size = ctype_sizeof(ct);
+    CData* cd;
+
+    if(flexible || size == 0)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' has no fixed size", tea_get_string(T, -1));
+    }
+
+    cd = cdata_new(T, ct, NULL);
+    cconv_cdata_tea(T, ct, cdata_ptr(cd), 1, false);
+    if(order_check_swap(T, 2))
+        cdata_bswap(ct, cdata_ptr(cd));
+
+    tea_push_lstring(T, cdata_ptr(cd), size);
+}
+
+/* Decode a ctype from the bytes of a string into plain Tea values */
+static void ffi_unpack(tea_State* T)
+{
+    bool flexible;
+    CType* ct = cparse_flexible(T, 0, &flexible);
+    size_t size = ctype_sizeof(ct), len;
+    const char* str = tea_check_lstring(T, 1, &len);
+    tea_Integer off = tea_opt_integer(T, 2, 0);
+    CData* cd;
+
+    if(flexible || size == 0)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' has no fixed size", tea_get_string(T, -1));
+    }
+
+    tea_arg_check(T, off >= 0 && (uint64_t)off <= len, 2, "offset out of range");
+    tea_arg_check(T, size <= len - off, 1, "string too short");
+
+    /* Copy out first, the string bytes need not be aligned */
+    cd = cdata_new_uninit(T, ct, 0);
+    memcpy(cdata_ptr(cd), str + off, size);
+    if(order_check_swap(T, 3))
+        cdata_bswap(ct, cdata_ptr(cd));
+
+    cconv_tea_value(T, ct, cdata_ptr(cd));
+}
+
+static void ffi_view_getindex(tea_State* T)
+{
+    CView* v = tea_check_udata(T, 0, VIEW_MT);
+    tea_Integer i = tea_check_integer(T, 1);
+
+    tea_arg_check(T, i >= 0 && (uint64_t)i < v->len, 1, "index out of range");
+    tea_push_integer(T, (uint8_t)v->ptr[i]);
+}
+
+static void ffi_view_eq(tea_State* T)
+{
+    const char *a, *b;
+    size_t alen, blen;
+    bool eq = cview_bytes(T, 0, &a, &alen) && cview_bytes(T, 1, &b, &blen)
+        && alen == blen && !memcmp(a, b, alen);
+
+    tea_push_bool(T, eq);
+}
+
+static void ffi_view_size(tea_State* T)
+{
+    CView* v = tea_check_udata(T, 0, VIEW_MT);
+    tea_push_integer(T, v->len);
+}
+
+/* Sub-view [start, end), sharing the pinned source */
+static void ffi_view_slice(tea_State* T)
+{
+    CView* v = tea_check_udata(T, 0, VIEW_MT);
+    tea_Integer start = tea_check_integer(T, 1);
+    tea_Integer end = tea_opt_integer(T, 2, v->len);
+
+    tea_arg_check(T, start >= 0 && (uint64_t)start <= v->len, 1, "index out of range");
+    tea_arg_check(T, end >= start && (uint64_t)end <= v->len, 2, "index out of range");
+
+    tea_get_udvalue(T, 0, 0);
+    cview_new(T, v->ptr + start, end - start, -1);
+}
+
+static void ffi_view_find(tea_State* T)
+{
+    CView* v = tea_check_udata(T, 0, VIEW_MT);
+    tea_Integer off = tea_opt_integer(T, 2, 0);
+    const char* needle;
+    size_t m, i;
+
+    if(!cview_bytes(T, 1, &needle, &m))
+        tea_type_error(T, 1, "string or view");
+    tea_arg_check(T, off >= 0 && (uint64_t)off <= v->len, 2, "offset out of range");
+
+    i = cvec_find(v->ptr + off, v->len - off, needle, m);
+    if(i == SIZE_MAX)
+        tea_push_nil(T);
+    else
+        tea_push_integer(T, off + i);
+}
+
+static void ffi_view_startswith(tea_State* T)
+{
+    CView* v = tea_check_udata(T, 0, VIEW_MT);
+    const char* p;
     size_t len;
 
-    if(tea_get_top(T) > 1)
-    {
-        len = tea_check_integer(T, 1);
+    if(!cview_bytes(T, 1, &p, &len))
+        tea_type_error(T, 1, "string or view");
 
-        switch(ct->type)
-        {
-        case CTYPE_PTR:
-        case CTYPE_ARRAY:
-        case CTYPE_RECORD:
-            tea_push_lstring(T, ptr, len);
-            return;
-        default:
-            goto converr;
-        }
-    }
+    tea_push_bool(T, len <= v->len && !memcmp(v->ptr, p, len));
+}
 
-    switch(ct->type)
+static void ffi_view_ptr(tea_State* T)
+{
+    CView* v = tea_check_udata(T, 0, VIEW_MT);
+    buffer_push_ptr(T, v->ptr, 0, true);
+}
+
+static void ffi_view_tostring(tea_State* T)
+{
+    CView* v = tea_check_udata(T, 0, VIEW_MT);
+    tea_push_lstring(T, v->ptr, v->len);
+}
+
+static const tea_Methods view_methods[] = {
+    { "[]", "method", ffi_view_getindex, 2, 0 },
+    { "==", "static", ffi_view_eq, 2, 0 },
+    { "size", "method", ffi_view_size, 1, 0 },
+    { "slice", "method", ffi_view_slice, 2, 1 },
+    { "find", "method", ffi_view_find, 2, 1 },
+    { "startswith", "method", ffi_view_startswith, 2, 0 },
+    { "ptr", "method", ffi_view_ptr, 1, 0 },
+    { "tostring", "method", ffi_view_tostring, 1, 0 },
+    { NULL, NULL }
+};
+
+/* View a string or the bytes of a cdata, pointers need a length */
+static void ffi_view(tea_State* T)
+{
+    size_t avail, len;
+    const char* p = buffer_check(T, 0, 2, false, &avail);
+
+    len = buffer_check_len(T, 1, avail);
+    cview_new(T, p, len, 0);
+}
+
+/* A member path of a record type resolved once to an offset and type */
+typedef struct CAccessor
+{
+    CType* rt;
+    CType* ct;
+    size_t offset;
+} CAccessor;
+
+/* Address of the member in the record at index idx of the cdata, which may
+** be the record itself, a pointer to records or an array of records */
+static char* accessor_check(tea_State* T, CAccessor* a, int idx, bool set)
+{
+    CData* cd = tea_check_udata(T, 1, CDATA_MT);
+    tea_Integer i = tea_opt_integer(T, idx, 0);
+    CType* et;
+    char* base;
+
+    switch(cdata_type(cd))
     {
+    case CTYPE_RECORD:
+        et = cd->ct;
+        base = cdata_ptr(cd);
+        tea_arg_check(T, i == 0, idx, "index out of range");
+        break;
     case CTYPE_PTR:
-        ct = ct->ptr;
+        et = cd->ct->ptr;
+        base = cdata_ptr_ptr(cd);
         break;
     case CTYPE_ARRAY:
-        array = ct->array;
-        ct = array->ct;
+        et = cd->ct->array->ct;
+        base = cdata_ptr(cd);
+        tea_arg_check(T, i >= 0 && (!cd->ct->array->size || (uint64_t)i < cd->ct->array->size),
+                    idx, "index out of range");
         break;
     default:
-        goto converr;
+        et = NULL;
+        base = NULL;
+        break;
     }
 
-    switch(ct->type)
+    if(!et || et->type != CTYPE_RECORD || et->rc != a->rt->rc)
     {
-    case CTYPE_VOID:
-    case CTYPE_CHAR:
-    case CTYPE_UCHAR:
-        break;
-    default:
-        goto converr;
+        ctype_tostring(T, a->rt);
+        tea_push_fstring(T, "expected ctype '%s' or a pointer or array of it", tea_get_string(T, -1));
+        tea_arg_error(T, 1, tea_get_string(T, -1));
+    }
+
+    if(set && (cd->ct->is_const || et->is_const))
+        tea_error(T, "assignment of read-only variable");
+
+    if(!base)
+        tea_error(T, "NULL pointer access");
+
+    return base + ctype_sizeof(et) * i + a->offset;
+}
+
+static void ffi_accessor_get(tea_State* T)
+{
+    CAccessor* a = tea_check_udata(T, 0, ACCESSOR_MT);
+    char* p = accessor_check(T, a, 2, false);
+
+    cconv_tea_cdata(T, a->ct, p);
+
+    /* Aggregates point into the cdata, keep it alive */
+    if(tea_test_udata(T, -1, CDATA_MT))
+    {
+        tea_push_value(T, 1);
+        tea_set_udvalue(T, -2, CDATA_OWNER);
     }
+}
+
+static void ffi_accessor_set(tea_State* T)
+{
+    CAccessor* a = tea_check_udata(T, 0, ACCESSOR_MT);
+    char* p = accessor_check(T, a, 3, true);
+
+    cconv_cdata_tea(T, a->ct, p, 2, false);
+    tea_push_nil(T);
+}
+
+static void ffi_accessor_tostring(tea_State* T)
+{
+    CAccessor* a = tea_check_udata(T, 0, ACCESSOR_MT);
+
+    tea_push_literal(T, "accessor<");
+    ctype_tostring(T, a->rt);
+    tea_get_udvalue(T, 0, 0);
+    tea_push_fstring(T, " %s>", tea_get_string(T, -1));
+    tea_remove(T, -2);
+    tea_concat(T, 3);
+}
+
+static const tea_Methods accessor_methods[] = {
+    { "get", "method", ffi_accessor_get, 2, 1 },
+    { "set", "method", ffi_accessor_set, 3, 1 },
+    { "tostring", "method", ffi_accessor_tostring, 1, 0 },
+    { NULL, NULL }
+};
+
+/* Resolve a dotted member path of a record type once for many cdata */
+static void ffi_accessor(tea_State* T)
+{
+    CType* rt = cparse_single(T, NULL, false);
+    const char* path = tea_check_string(T, 1);
+    CAccessor* a;
+    size_t offset;
+    CType* ct;
 
-    if(array && array->size)
+    if(ctype_ptr_to(rt, CTYPE_RECORD))
+        rt = rt->ptr;
+
+    if(rt->type != CTYPE_RECORD)
     {
-        char* p = memchr(ptr, '\0', array->ft.size);
-        len = p ? p - ptr : array->ft.size;
-        tea_push_lstring(T, ptr, len);
+        ctype_tostring(T, rt);
+        tea_error(T, "ctype '%s' is not a record", tea_get_string(T, -1));
     }
-    else
+
+    ct = crecord_find_path(rt, path, &offset);
+    if(!ct)
     {
-        tea_push_string(T, ptr);
+        ctype_tostring(T, rt);
+        tea_error(T, "ctype '%s' has no member named '%s'", tea_get_string(T, -1), path);
     }
-    return;
 
-converr:
-    __cdata_tostring(T, cd);
-    tea_push_fstring(T, "cannot convert '%s' to 'string'", tea_get_string(T, -1));
-    tea_arg_check(T, false, 0, tea_get_string(T, -1));
-    return;
+    a = tea_new_udatav(T, sizeof(CAccessor), 1, ACCESSOR_MT);
+    a->rt = rt;
+    a->ct = ct;
+    a->offset = offset;
+
+    tea_push_value(T, 1);
+    tea_set_udvalue(T, -2, 0);
 }
 
-static void ffi_copy(tea_State* T)
+#define WALK_FIELDS 32
+
+typedef struct WalkField
 {
+    const char* name;
+    CType* ct;
+    size_t offset;
+} WalkField;
+
+static inline char* walk_next(char* p, size_t link)
+{
+    return *(char**)(p + link);
+}
+
+/* Follow a pointer member from node to node, collecting the nodes or
+** selected members of each. Stops at NULL or the limit, a cycle is an error */
+static void ffi_walk(tea_State* T)
+{
+    WalkField fields[WALK_FIELDS];
     CData* cd = tea_check_udata(T, 0, CDATA_MT);
-    void* dst = (cdata_type(cd) == CTYPE_PTR) ? cdata_ptr_ptr(cd) : cdata_ptr(cd);
-    const void* src;
-    size_t len;
+    const char* link_name = tea_check_string(T, 1);
+    size_t limit = SIZE_MAX, link, n = 0;
+    bool columns = tea_opt_bool(T, 4, false);
+    CType *rt, *lt;
+    char *node, *slow;
+    int nfield = -1, i, base;
+
+    switch(cdata_type(cd))
+    {
+    case CTYPE_PTR:
+        if(!ctype_ptr_to(cd->ct, CTYPE_RECORD))
+            goto bad;
+        rt = cd->ct->ptr;
+        node = cdata_ptr_ptr(cd);
+        break;
+    case CTYPE_RECORD:
+        rt = cd->ct;
+        node = cdata_ptr(cd);
+        break;
+    default:
+    bad:
+        ctype_tostring(T, cd->ct);
+        tea_push_fstring(T, "ctype '%s' is not a record or record pointer", tea_get_string(T, -1));
+        tea_arg_error(T, 0, tea_get_string(T, -1));
+        return;
+    }
+
+    lt = cdata_check_path(T, rt, 1, &link);
+    if(!ctype_ptr_to(lt, CTYPE_RECORD) || lt->ptr->rc != rt->rc)
+    {
+        ctype_tostring(T, rt);
+        tea_error(T, "member '%s' is not a pointer to ctype '%s'", link_name, tea_get_string(T, -1));
+    }
+
+    if(!tea_is_nonenil(T, 2))
+    {
+        tea_check_list(T, 2);
+        nfield = tea_len(T, 2);
+        tea_arg_check(T, nfield <= WALK_FIELDS, 2, "too many fields");
+
+        for(i = 0; i < nfield; i++)
+        {
+            tea_get_item(T, 2, i);
+            fields[i].name = tea_check_string(T, -1);
+            fields[i].ct = cdata_check_path(T, rt, tea_get_top(T) - 1, &fields[i].offset);
+            tea_pop(T, 1);
+        }
+    }
+
+    if(!tea_is_nonenil(T, 3))
+    {
+        tea_Integer l = tea_check_integer(T, 3);
+        tea_arg_check(T, l >= 0, 3, "limit out of range");
+        limit = l;
+    }
 
-    if(tea_get_top(T) < 3)
+    tea_set_top(T, 3);
+    base = tea_get_top(T);
+
+    if(columns && nfield >= 0)
     {
-        src = tea_check_lstring(T, 1, &len);
-        memcpy(dst, src, len);
-        ((char*)dst)[len++] = '\0';
+        for(i = 0; i < nfield; i++)
+            tea_new_list(T, 0);
     }
     else
     {
-        len = tea_check_integer(T, 2);
+        tea_new_list(T, 0);
+    }
 
-        if(tea_is_string(T, 1))
-            src = tea_get_string(T, 1);
+    slow = node;
+    while(node && n < limit)
+    {
+        if(nfield < 0)
+        {
+            CData* p = cdata_new(T, lt, NULL);
+            cdata_ptr_set(p, node);
+            tea_add_item(T, base);
+        }
+        else if(columns)
+        {
+            for(i = 0; i < nfield; i++)
+            {
+                cconv_tea_value(T, fields[i].ct, node + fields[i].offset);
+                tea_add_item(T, base + i);
+            }
+        }
         else
-            src = cdata_ptr(tea_check_udata(T, 1, CDATA_MT));
+        {
+            tea_new_map(T);
+            for(i = 0; i < nfield; i++)
+            {
+                cconv_tea_value(T, fields[i].ct, node + fields[i].offset);
+                tea_set_key(T, -2, fields[i].name);
+            }
+            tea_add_item(T, base);
+        }
 
-        memcpy(dst, src, len);
+        node = walk_next(node, link);
+        n++;
+
+        /* The slow pointer moves at half speed, so a cycle is met in it */
+        if(!(n & 1))
+            slow = walk_next(slow, link);
+        if(node && node == slow)
+            tea_error(T, "cycle detected after %d nodes", (int)n);
     }
 
-    tea_push_integer(T, len);
+    if(columns && nfield >= 0)
+    {
+        tea_new_map(T);
+        for(i = 0; i < nfield; i++)
+        {
+            tea_push_value(T, base + i);
+            tea_set_key(T, -2, fields[i].name);
+        }
+    }
 }
 
-static void ffi_fill(tea_State* T)
+/* Deep copy of a cdata into maps, lists and numbers. A pointer to a record
+** or array converts its target */
+static void ffi_totea(tea_State* T)
 {
     CData* cd = tea_check_udata(T, 0, CDATA_MT);
-    int len = tea_check_integer(T, 1);
-    int c = tea_opt_integer(T, 2, 0);
-    void* dst = (cdata_type(cd) == CTYPE_PTR) ? cdata_ptr_ptr(cd) : cdata_ptr(cd);
-    memset(dst, c, len);
+    tea_Integer depth = tea_opt_integer(T, 1, INT_MAX);
+    int flags = 0;
+    CType* ct = cd->ct;
+    void* ptr = cdata_ptr(cd);
+
+    tea_arg_check(T, depth >= 0, 1, "depth out of range");
+
+    if(!opt_flag(T, 2, "bytes"))
+        flags |= CCONV_STRINGS;
+    if(!opt_flag(T, 2, "addresses"))
+        flags |= CCONV_POINTERS;
+
+    /* Functions have no value to convert, only their address */
+    if(ct->type == CTYPE_FUNC)
+    {
+        if(flags & CCONV_POINTERS)
+            tea_arg_error(T, 0, "cannot convert function cdata");
+        tea_push_integer(T, (intptr_t)cdata_ptr_ptr(cd));
+        return;
+    }
+
+    if(ct->type == CTYPE_PTR && (ctype_ptr_to(ct, CTYPE_RECORD) || ctype_ptr_to(ct, CTYPE_ARRAY)))
+    {
+        ptr = cdata_ptr_ptr(cd);
+        ct = ct->ptr;
+
+        if(!ptr)
+        {
+            tea_push_nil(T);
+            return;
+        }
+    }
+
+    cconv_tea_deep(T, ct, ptr, depth > INT_MAX ? INT_MAX : (int)depth, flags);
 }
 
-static void ffi_errno(tea_State* T)
+/* Attach a map of methods and operators to a record type. Record and
+** record pointer cdata look up missing members in it */
+static void ffi_metatype(tea_State* T)
 {
-    int cur = errno;
+    CType* ct = cparse_single(T, NULL, true);
+    CType* rt = ct;
+    int ctidx = tea_get_top(T) > 2 ? 2 : 0;
 
-    if(tea_get_top(T) > 0)
-        errno = tea_check_integer(T, 0);
+    tea_check_type(T, 1, TEA_TYPE_MAP);
 
-    tea_push_integer(T, cur);
+    if(ctype_ptr_to(rt, CTYPE_RECORD))
+        rt = rt->ptr;
+
+    if(rt->type != CTYPE_RECORD)
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' is not a record", tea_get_string(T, -1));
+    }
+
+    if(rt->rc->has_meta)
+    {
+        ctype_tostring(T, rt);
+        tea_error(T, "ctype '%s' already has a metatype", tea_get_string(T, -1));
+    }
+
+    tea_get_fieldp(T, TEA_REGISTRY_INDEX, &cmeta_registry);
+    tea_push_pointer(T, rt->rc);
+    tea_push_value(T, 1);
+    tea_set_field(T, -3);
+    tea_pop(T, 1);
+
+    tea_get_fieldp(T, TEA_REGISTRY_INDEX, &cmethod_registry);
+    tea_push_pointer(T, rt->rc);
+    tea_new_map(T);
+    tea_set_field(T, -3);
+    tea_pop(T, 1);
+
+    rt->rc->has_meta = true;
+    tea_push_value(T, ctidx);
 }
 
-/* Check string against a linear list of matches */
-int cparse_case(const char* str, size_t len, const char* match)
+/* NULL-terminated const char* array over the strings of a list. The
+** cdata holds its own list of the strings so they stay alive */
+static void ffi_strarray(tea_State* T)
 {
-    size_t len1;
-    int n;
-    for(n = 0; (len1 = (int)*match++); n++, match += len1)
+    CType match = { .type = CTYPE_ARRAY };
+    bool flexible;
+    const char** p;
+    CType* ct;
+    CData* cd;
+    int i, n;
+
+    tea_check_list(T, 0);
+    n = tea_len(T, 0);
+
+    tea_push_literal(T, "const char*");
+    ct = cparse_flexible(T, -1, &flexible);
+    tea_pop(T, 1);
+
+    match.array = carray_lookup(T, n + 1, ct);
+    ct = ctype_lookup(T, &match, false);
+    cd = cdata_new_uninit(T, ct, 0);
+    p = cdata_ptr(cd);
+
+    tea_new_list(T, n);
+    for(i = 0; i < n; i++)
     {
-        if(len == len1 && !memcmp(match, str, len1))
-        return n;
+        tea_get_item(T, 0, i);
+        if(!tea_is_string(T, -1))
+        {
+            tea_push_fstring(T, "expected a list of strings, got %s at index %d", tea_typeof(T, -1), i);
+            tea_arg_error(T, 0, tea_get_string(T, -1));
+        }
+        p[i] = tea_get_string(T, -1);
+        tea_add_item(T, -2);
     }
-    return -1;
+    p[n] = NULL;
+
+    tea_set_udvalue(T, -2, CDATA_OWNER);
 }
 
-static void ffi__abi(tea_State* T)
+/* List of the strings of a char* array, n entries or up to the NULL */
+static void ffi_fromstrarray(tea_State* T)
 {
-    size_t len;
-    const char* str = tea_check_lstring(T, 0, &len);
-    int b = cparse_case(str, len,
-#if FFI_64
-    "\00564bit"
-#else
-    "\00532bit"
-#endif
-#if FFI_LE
-    "\002le"
-#else
-    "\002be"
-#endif
-    ) >= 0;
-    tea_push_bool(T, b);
+    CType* ct;
+    size_t n, i;
+    char** p = cdata_check_elems(T, 0, -1, &ct, &n);
+
+    if(!ctype_ptr_to(ct, CTYPE_CHAR) && !ctype_ptr_to(ct, CTYPE_UCHAR))
+    {
+        ctype_tostring(T, ct);
+        tea_error(T, "ctype '%s' is not a char pointer", tea_get_string(T, -1));
+    }
+
+    if(!p)
+        tea_arg_error(T, 0, "NULL pointer access");
+
+    if(!tea_is_nonenil(T, 1))
+    {
+        tea_Integer len = tea_check_integer(T, 1);
+        tea_arg_check(T, len >= 0 && (!n || (uint64_t)len <= n), 1, "length out of range");
+        n = len;
+    }
+    else
+    {
+        size_t max = n ? n : SIZE_MAX;
+        for(n = 0; n < max && p[n]; n++)
+            ;
+    }
+
+    tea_new_list(T, n);
+    for(i = 0; i < n; i++)
+    {
+        if(p[i])
+            tea_push_string(T, p[i]);
+        else
+            tea_push_nil(T);
+        tea_add_item(T, -2);
+    }
+}
+
+static void ffi_buffer(tea_State* T)
+{
+    tea_Integer cap = tea_opt_integer(T, 0, 0);
+
+    tea_arg_check(T, cap >= 0, 0, "capacity must be non-negative");
+    cbuf_new(T, cap);
 }
 
 static const tea_Reg funcs[] = {
     { "cdef", ffi_cdef, 1, 0 },
     { "load", ffi_load, 1, 1 },
     { "cnew", ffi_cnew, 1, 2 },
+    { "cnew_aligned", ffi_cnew_aligned, 2, 2 },
+    { "cnew_uninit", ffi_cnew_uninit, 1, 2 },
     { "cast", ffi_cast, 2, 0 },
+    { "soa", ffi_soa, 2, 0 },
     { "typeof", ffi_typeof, 1, 1 },
     { "addressof", ffi_addressof, 1, 0 },
-    { "gc", ffi_gc, 2, 0 },
+    { "gc", ffi_gc, 2, 1 },
+    { "extmem", ffi_extmem, 0, 1 },
     { "sizeof", ffi_sizeof, 1, 0 },
     { "offsetof", ffi_offsetof, 2, 0 },
     { "alignof", ffi_alignof, 1, 0 },
     { "istype", ffi_istype, 2, 0 },
     { "tonumber", ffi_tonumber, 1, 0 },
-    { "string", ffi_string, 1, 1 },
-    { "copy", ffi_copy, 2, 1 },
-    { "fill", ffi_fill, 2, 1 },
+    { "string", ffi_string, 1, 2 },
+    { "copy", ffi_copy, 2, 3 },
+    { "fill", ffi_fill, 1, 3 },
+    { "hash", ffi_hash, 1, 1 },
+    { "move", ffi_move, 2, 3 },
+    { "compare", ffi_compare, 2, 3 },
+    { "find", ffi_find, 2, 2 },
+    { "fillpattern", ffi_fillpattern, 2, 2 },
+    { "sort", ffi_sort, 1, 3 },
+    { "bsearch", ffi_bsearch, 3, 1 },
+    { "gather", ffi_gather, 3, 1 },
+    { "scatter", ffi_scatter, 4, 0 },
+    { "mapfile", ffi_mapfile, 2, 3 },
+    { "bigalloc", ffi_bigalloc, 1, 2 },
+    { "buffer", ffi_buffer, 0, 1 },
+    { "pack", ffi_pack, 2, 1 },
+    { "unpack", ffi_unpack, 2, 2 },
+    { "view", ffi_view, 1, 2 },
+    { "strarray", ffi_strarray, 1, 0 },
+    { "fromstrarray", ffi_fromstrarray, 1, 1 },
+    { "walk", ffi_walk, 2, 3 },
+    { "totea", ffi_totea, 1, 2 },
+    { "metatype", ffi_metatype, 2, 0 },
+    { "accessor", ffi_accessor, 2, 0 },
+    { "unmap", ffi_unmap, 1, 0 },
+    { "madvise", ffi_madvise, 2, 0 },
+    { "msync", ffi_msync, 1, 1 },
     { "errno", ffi_errno, 0, 1 },
     { "abi", ffi__abi, 1, 0 },
     { NULL, NULL }
@@ -918,6 +2949,14 @@ TEAMOD_API void tea_import_ffi(tea_State* T)
     tea_new_map(T);
     tea_set_fieldp(T, TEA_REGISTRY_INDEX, &clib_registry);
 
+    tea_new_map(T);
+    tea_set_fieldp(T, TEA_REGISTRY_INDEX, &cmeta_registry);
+
+    tea_new_map(T);
+    tea_set_fieldp(T, TEA_REGISTRY_INDEX, &cmethod_registry);
+
+    cmem_init(T);
+
     tea_create_class(T, "CType", ctype_methods);
     tea_set_key(T, TEA_REGISTRY_INDEX, CTYPE_MT);
 
@@ -927,8 +2966,32 @@ TEAMOD_API void tea_import_ffi(tea_State* T)
     tea_create_class(T, "CLib", clib_methods);
     tea_set_key(T, TEA_REGISTRY_INDEX, CLIB_MT);
 
+    tea_create_class(T, "SoA", soa_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, SOA_MT);
+
+    tea_create_class(T, "SoARow", soarow_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, SOAROW_MT);
+
+    tea_create_class(T, "CMapping", mmap_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, MMAP_MT);
+
+    tea_create_class(T, "Buffer", buffer_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, BUFFER_MT);
+
+    tea_create_class(T, "View", view_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, VIEW_MT);
+
+    tea_create_class(T, "CMethod", method_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, METHOD_MT);
+
+    tea_create_class(T, "Accessor", accessor_methods);
+    tea_set_key(T, TEA_REGISTRY_INDEX, ACCESSOR_MT);
+
     tea_create_module(T, "ffi", funcs);
 
     clib_default(T);
     tea_set_attr(T, -2, "C");
+
+    tea_create_class(T, "Reduce", reduce_methods);
+    tea_set_attr(T, -2, "reduce");
 }
\ No newline at end of file
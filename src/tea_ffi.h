@@ -18,6 +18,14 @@
 #define CDATA_MT    "cdata"
 #define CTYPE_MT    "ctype"
 #define CLIB_MT     "clib"
+#define SOA_MT      "soa"
+#define SOAROW_MT   "soarow"
+#define MMAP_MT     "mmap"
+#define BUFFER_MT   "buffer"
+#define VIEW_MT     "view"
+#define METHOD_MT   "cmethod"
+#define ACCESSOR_MT "accessor"
+#define CMEM_MT     "cmemstate"
 
 extern const char* crecord_registry;
 extern const char* carray_registry;
@@ -25,6 +33,9 @@ extern const char* cfunc_registry;
 extern const char* ctype_registry;
 extern const char* ctdef_registry;
 extern const char* clib_registry;
+extern const char* cmeta_registry;
+extern const char* cmethod_registry;
+extern const char* cmem_registry;
 
 ffi_type* ffi_get_type(size_t size, bool s);
 void ffi_tea_num(tea_State* T, ffi_type* ft, void* ptr, int idx);